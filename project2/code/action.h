@@ -23,7 +23,8 @@ public:
 	class place; // create a placing action with position and tile
 
 public:
-	virtual board::reward apply(board& b) const {
+	virtual board::reward apply(board& b) const; // see below, dispatched by type without lookup
+	board::reward apply_prototype(board& b) const {
 		auto proto = entries().find(type());
 		if (proto != entries().end()) return proto->second->reinterpret(this).apply(b);
 		return -1;
@@ -124,3 +125,15 @@ protected:
 	action& reinterpret(const action* a) const { return *new (const_cast<action*>(a)) place(*a); }
 	static __attribute__((constructor)) void init() { entries()[type_flag('p')] = new place; }
 };
+
+/**
+ * apply the action by a switch on its type, so that the built-in actions cost no more than board::slide or board::place
+ * (i.e., without the prototype lookup and the reinterpretation), and other registered actions fall back to the prototypes
+ */
+inline board::reward action::apply(board& b) const {
+	switch (type()) {
+	case action::slide::type: return action::slide(*this).action::slide::apply(b);
+	case action::place::type: return action::place(*this).action::place::apply(b);
+	default: return apply_prototype(b);
+	}
+}
@@ -16,21 +16,28 @@
 #include <algorithm>
 #include <fstream>
 #include <cassert>
+#include <memory>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <cmath>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #include "board.h"
+#include "bitboard.h"
 #include "action.h"
 #include "weight.h"
+#include "cache.h"
+#include "ntuple.h"
+#include "rng.h"
 
 using namespace std;
 
 class agent {
 public:
 	agent(const std::string& args = "") {
-		std::stringstream ss("name=unknown role=unknown " + args);
-		for (std::string pair; ss >> pair; ) {
-			std::string key = pair.substr(0, pair.find('='));
-			std::string value = pair.substr(pair.find('=') + 1);
-			meta[key] = { value };
-		}
+		configure("name=unknown role=unknown " + args);
 	}
 	virtual ~agent() {}
 	virtual void open_episode(const std::string& flag = "") {}
@@ -53,21 +60,51 @@ protected:
 		operator numeric() const { return numeric(std::stod(value)); }
 	};
 	std::map<key, value> meta;
+
+	void configure(const std::string& args) {
+		std::stringstream ss(args);
+		for (std::string pair; ss >> pair; ) {
+			std::string key = pair.substr(0, pair.find('='));
+			std::string value = pair.substr(pair.find('=') + 1);
+			meta[key] = { value };
+		}
+	}
 };
 
 /**
  * base agent for agents with randomness
+ * the generator is selected by rng= (see rng.h), and is reseeded by (seed, stream, episode) on each episode,
+ * so that episode i of a seed is the same no matter how the episodes are distributed over parallel workers
+ *
+ * arguments: seed=S, stream=N (an independent stream, e.g., for each parallel worker),
+ *            episode=I (the index of the first episode, 0 by default)
  */
 class random_agent : public agent {
 public:
-	random_agent(const std::string& args = "") : agent(args) {
+	random_agent(const std::string& args = "") : agent(args),
+		engine(meta.find("rng") != meta.end() ? std::string(meta["rng"]) : "xoshiro"), seed(0), stream(0), episode(0) {
 		if (meta.find("seed") != meta.end())
-			engine.seed(int(meta["seed"]));
+			seed = uint64_t(meta["seed"]);
+		if (meta.find("stream") != meta.end())
+			stream = uint64_t(meta["stream"]);
+		if (meta.find("episode") != meta.end())
+			engine.seed({ seed, stream, episode = uint64_t(meta["episode"]) });
+		else if (meta.find("stream") != meta.end()) // derive an independent stream, e.g., for parallel workers
+			engine.seed({ seed, stream });
+		else if (meta.find("seed") != meta.end())
+			engine.seed({ seed });
 	}
 	virtual ~random_agent() {}
 
+	virtual void open_episode(const std::string& flag = "") {
+		uint64_t index = episode++;
+		if (engine.generator() != rng::legacy) // rng=std keeps a single sequence as before
+			engine.seed({ seed, stream, index });
+	}
+
 protected:
-	std::default_random_engine engine;
+	rng engine;
+	uint64_t seed, stream, episode;
 };
 
 /**
@@ -76,15 +113,100 @@ protected:
 
 class state {
 public:
-	board cur, next;
+	bitboard cur, next;
 	float reward;
-	state(const board& _cur, const board& _next, float _reward){
+	state(const bitboard& _cur, const bitboard& _next, float _reward){
 		cur = _cur;
 		next = _next;
 		reward = _reward;
 	}
 };
 
+/**
+ * default random environment, i.e., placer
+ * place the hint tile and decide a new hint tile
+ */
+class random_placer : public random_agent {
+public:
+	random_placer(const std::string& args = "") : random_agent("name=place role=placer " + args) {}
+
+	virtual action take_action(const board& after) {
+		const side& cells = spaces(after.last());
+		int space[16];
+		std::copy(cells.pos, cells.pos + cells.size, space);
+		engine.shuffle(space, space + cells.size);
+		for (int* it = space; it != space + cells.size; it++) {
+			int pos = *it;
+			if (after(pos) != 0) continue;
+
+			int bag[3], num = 0;
+			for (board::cell t = 1; t <= 3; t++)
+				for (size_t i = 0; i < after.bag(t); i++)
+					bag[num++] = t;
+			engine.shuffle(bag, bag + num);
+
+			board::cell tile = after.hint() ?: bag[--num];
+			board::cell hint = bag[--num];
+
+			return action::place(pos, tile, hint);
+		}
+		return action();
+	}
+
+	/**
+	 * enumerate every placement of a state (board or bitboard) with its probability under this placer, i.e.,
+	 * an empty cell on the side opposite to the last slide (uniformly), the hint tile (or a tile drawn from the bag
+	 * if there is no hint yet), and the next hint drawn from the rest of the bag
+	 * each outcome is passed to f(pos, tile, hint, prob) without any allocation
+	 * return the number of outcomes, where 0 means that no tile can be placed
+	 */
+	template<typename state, typename callback>
+	static size_t enumerate(const state& after, callback&& f) {
+		const side& cells = spaces(after.last());
+		unsigned empty = 0;
+		for (unsigned i = 0; i < cells.size; i++) empty += (after(cells.pos[i]) == 0);
+		unsigned total = after.bag(1) + after.bag(2) + after.bag(3);
+		if (empty == 0 || total == 0 || (after.hint() == 0 && total < 2)) return 0;
+
+		size_t num = 0;
+		for (unsigned i = 0; i < cells.size; i++) {
+			unsigned pos = cells.pos[i];
+			if (after(pos) != 0) continue;
+			for (unsigned tile = 1; tile <= 3; tile++) {
+				if (after.hint() ? tile != after.hint() : after.bag(tile) == 0) continue;
+				unsigned drawn = after.hint() ? 1 : after.bag(tile); // the tile is drawn from the bag if there is no hint
+				unsigned left = after.hint() ? total : total - 1;
+				for (unsigned hint = 1; hint <= 3; hint++) {
+					unsigned count = after.bag(hint) - (after.hint() == 0 && hint == tile);
+					if (count == 0) continue;
+					f(pos, tile, hint, float(drawn * count) / ((after.hint() ? 1 : total) * left * empty));
+					num++;
+				}
+			}
+		}
+		return num;
+	}
+
+protected:
+	/**
+	 * the cells where a tile can be placed after the last slide, or anywhere at the beginning
+	 */
+	struct side {
+		unsigned size;
+		int pos[16];
+	};
+	static const side& spaces(unsigned last) {
+		static const side space[5] = {
+			{ 4, { 12, 13, 14, 15 } },
+			{ 4, { 0, 4, 8, 12 } },
+			{ 4, { 0, 1, 2, 3 } },
+			{ 4, { 3, 7, 11, 15 } },
+			{ 16, { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 } },
+		};
+		return space[last];
+	}
+};
+
 class weight_agent : public agent {
 public:
 	weight_agent(const std::string& args = "") : agent(args), alpha(0) {
@@ -97,14 +219,14 @@ public:
 	}
 
 
-	float board_value(const board& b){
+	float board_value(const bitboard& b){
 		 // 0 ~ 3 are four rows, 4 ~ 7 are four columns.
 		float value = 0;
 		for(int i=0;i<4;i++){
 			int tuple = 0;
 			for(int j=0;j<4;j++){
 				tuple <<= 4;
-				tuple ^= b[i][j];
+				tuple ^= b(i * 4 + j);
 			}
 			value += net[i][tuple];
 		}
@@ -112,7 +234,7 @@ public:
 			int tuple = 0;
 			for(int j=0;j<4;j++){
 				tuple <<= 4;
-				tuple ^= b[j][i-4];
+				tuple ^= b(j * 4 + i - 4);
 			}
 			value += net[i][tuple];
 		}
@@ -120,12 +242,12 @@ public:
 		return value;		
 	}
 
-	void update_net(const board& b, float delta){
+	void update_net(const bitboard& b, float delta){
 		for(int i=0;i<4;i++){
 			int tuple = 0;
 			for(int j=0;j<4;j++){
 				tuple <<= 4;
-				tuple ^= b[i][j];
+				tuple ^= b(i * 4 + j);
 			}
 			net[i][tuple] += delta;
 		}
@@ -133,7 +255,7 @@ public:
 			int tuple = 0;
 			for(int j=0;j<4;j++){
 				tuple <<= 4;
-				tuple ^= b[j][i-4];
+				tuple ^= b(j * 4 + i - 4);
 			}
 			net[i][tuple] += delta;
 		}
@@ -154,13 +276,14 @@ public:
 	}
 
 
-	virtual action take_action(const board& before) {
+	virtual action take_action(const board& b) {
+		const bitboard before(b);
 		float max_value = std::numeric_limits<float>::min();
 		float max_reward = -1;
 		int best_action = -1;
 
 		for(auto i: {0, 1, 2, 3}){
-			board after(before);
+			bitboard after(before);
 			board::reward reward = after.slide(i);
 			float total = reward + board_value(after);
 			if(reward != -1 and (total > max_value or max_value == std::numeric_limits<float>::min())){
@@ -170,7 +293,7 @@ public:
 			}
 		}
 		if(best_action != -1){
-			board after(before);
+			bitboard after(before);
 			after.slide(best_action);
 			stats.emplace_back(before, after, max_reward);
 			return action::slide(best_action);
@@ -197,21 +320,10 @@ protected:
 		for (size_t size; in >> size; net.emplace_back(size));
 	}
 	virtual void load_weights(const std::string& path) {
-		std::ifstream in(path, std::ios::in | std::ios::binary);
-		if (!in.is_open()) std::exit(-1);
-		uint32_t size;
-		in.read(reinterpret_cast<char*>(&size), sizeof(size));
-		net.resize(size);
-		for (weight& w : net) in >> w;
-		in.close();
+		if (!weight::load(path, net)) std::exit(-1);
 	}
 	virtual void save_weights(const std::string& path) {
-		std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
-		if (!out.is_open()) std::exit(-1);
-		uint32_t size = net.size();
-		out.write(reinterpret_cast<char*>(&size), sizeof(size));
-		for (weight& w : net) out << w;
-		out.close();
+		if (!weight::save(path, net)) std::exit(-1);
 	}
 
 protected:
@@ -223,126 +335,658 @@ protected:
 
 class iso_weight_agent : public agent {
 public:
-	iso_weight_agent(const std::string& args = "") : agent(args), alpha(0) {
+	iso_weight_agent(const std::string& args = "") : agent(args),
+		shared(std::make_shared<std::vector<weight>>()), net(*shared), alpha(0), trained(std::make_shared<progress>()) {
+		if (meta.find("hugepages") != meta.end())
+			placement::huge_pages() = int(meta["hugepages"]);
+		if (meta.find("numa") != meta.end())
+			init_numa(meta["numa"]);
+		if (meta.find("stage") != meta.end())
+			init_stages(meta["stage"]);
+		if (meta.find("tc") != meta.end())
+			coherence = int(meta["tc"]);
 		if (meta.find("init") != meta.end())
 			init_weights(meta["init"]);
 		if (meta.find("load") != meta.end())
 			load_weights(meta["load"]);
+		else if (num_stages > 1)
+			expand_stages(1);
 		if (meta.find("alpha") != meta.end())
 			alpha = float(meta["alpha"]);
+		if (meta.find("lambda") != meta.end())
+			lambda = float(meta["lambda"]);
+		if (meta.find("horizon") != meta.end())
+			horizon = int(meta["horizon"]);
+		if (coherence)
+			init_coherence();
+		if (meta.find("quant") != meta.end())
+			init_quantized(meta["quant"]);
+		if (meta.find("simd") != meta.end())
+			vectorized = vectorized && int(meta["simd"]);
+		if (meta.find("checkpoint") != meta.end())
+			init_checkpoint(meta["checkpoint"]);
 		
 		build_iso_tuples();		
 	}
-	
-	vector<vector<int>> tuples = {
-		{0, 1, 2, 4, 5,  6},
-		{1, 2, 5, 6, 9, 13},
-		{0, 1, 2, 3, 4,  5},
-		{0, 1, 5, 6, 7, 10}
+
+	/**
+	 * create a worker for parallel training, which shares the weight tables with the master
+	 * the tables are updated by all workers without locking (Hogwild!-style),
+	 * and only the master saves the weights on destruction
+	 */
+	iso_weight_agent(const iso_weight_agent& master) : iso_weight_agent(master, master.shared) {}
+
+protected:
+	/**
+	 * create an agent of the same configuration on the given tables, e.g., on a snapshot of the master
+	 */
+	iso_weight_agent(const iso_weight_agent& master, std::shared_ptr<std::vector<weight>> tables) : agent(),
+		shared(tables), net(*shared), alpha(master.alpha), trained(master.trained), memo(master.memo),
+		ckpt(master.ckpt), lambda(master.lambda), horizon(master.horizon), coherence(master.coherence),
+		num_stages(master.num_stages), stage_of(master.stage_of), stage_tiles(master.stage_tiles),
+		storage(master.storage), half_net(master.half_net), fixed_net(master.fixed_net), fixed_unit(master.fixed_unit),
+		vectorized(master.vectorized) {
+		meta = master.meta;
+		meta.erase("save");
+		tuples = master.tuples;
+		build_iso_tuples();
+	}
+
+	/**
+	 * create an agent of its own arguments on the tables of another agent, e.g., a placer attacking the slider
+	 * the agent only evaluates the network, i.e., it neither learns, caches afterstates, nor saves checkpoints
+	 */
+	iso_weight_agent(const std::string& args, const iso_weight_agent& network) : iso_weight_agent(network, network.shared) {
+		meta.clear();
+		configure("name=unknown role=unknown " + args);
+		alpha = 0;
+		trained = std::make_shared<progress>();
+		memo.reset();
+		ckpt.reset();
+	}
+
+public:	
+	/**
+	 * the default tuples, compiled so that the feature extraction is unrolled with constant shifts
+	 * tuples may be changed for experiments, in which case the runtime patterns below are used instead
+	 */
+	typedef ntuple_network<
+		ntuple<0, 1, 2, 4, 5,  6>,
+		ntuple<1, 2, 5, 6, 9, 13>,
+		ntuple<0, 1, 2, 3, 4,  5>,
+		ntuple<0, 1, 5, 6, 7, 10>
+	> network;
+	vector<vector<int>> tuples = network::patterns();
+
+	/**
+	 * flat feature patterns, i.e., 8 isomorphisms of each tuple
+	 * each pattern keeps the bit offsets of its cells in the packed board and the table it indexes
+	 */
+	static constexpr size_t max_iso = 32; // 4 tuples x 8 isomorphisms
+	struct pattern {
+		uint8_t shift[6];
+		uint8_t size;
+		uint8_t table;
+	};
+	std::array<pattern, max_iso> iso_tuples;
+	size_t num_iso = 0;
+
+	/**
+	 * feature indices of a board, extracted once and reused by both evaluation and update,
+	 * along with the first table of the stage of the board
+	 */
+	struct features {
+		uint32_t index[max_iso];
+		uint32_t base;
+		uint32_t& operator[](size_t i) { return index[i]; }
+		const uint32_t& operator[](size_t i) const { return index[i]; }
 	};
 
-	vector<vector<int>> iso_tuples;
-	
 	void build_iso_tuples(){
+		assert(tuples.size() * 8 <= max_iso);
 		board b;
 		for(int i=0;i<16;i++) b(i) = i;
-		for(auto tuple: tuples){
+		num_iso = 0;
+		compiled = (tuples == network::patterns());
+		for(size_t t=0;t<tuples.size();t++){
+			assert(tuples[t].size() <= 6);
 			board tmp(b);
-			for(int r=0;r<4;r++){
-				vector<int> tmp_idx;
-				for(auto idx: tuple){
-					tmp_idx.push_back(tmp(idx));
+			for(int r=0;r<8;r++){
+				if(r == 4) tmp.reflect_vertical();
+				pattern& iso = iso_tuples[num_iso++];
+				iso.size = tuples[t].size();
+				iso.table = t;
+				for(size_t k=0;k<iso.size;k++){
+					iso.shift[k] = tmp(tuples[t][k]) * 4;
+					iso_lanes[t].word[k][r] = iso.shift[k] >> 5;
+					iso_lanes[t].shift[k][r] = iso.shift[k] & 31;
 				}
-				iso_tuples.push_back(tmp_idx);
 				tmp.rotate(1);
 			}
-			tmp.reflect_vertical();
-			for(int r=0;r<4;r++){
-				vector<int> tmp_idx;
-				for(auto idx: tuple){
-					tmp_idx.push_back(tmp(idx));
-				}
-				iso_tuples.push_back(tmp_idx);
-				tmp.rotate(1);
+		}
+	}
+
+	void extract(const bitboard& b, features& f) const {
+		const bitboard::grid raw = b.raw();
+		if(vectorized) extract_avx2(raw, f);
+		else if(compiled) network::extract(raw, f.index);
+		else for(size_t i=0;i<num_iso;i++){
+			const pattern& iso = iso_tuples[i];
+			uint32_t feature = 0;
+			for(size_t k=0;k<iso.size;k++){
+				feature = (feature << 4) | ((raw >> iso.shift[k]) & 0x0f);
 			}
+			f[i] = feature;
 		}
+		f.base = num_stages > 1 ? stage_of[max_tile(raw)] * tuples.size() : 0;
 	}
 
-	float board_value(const board& b){
+	static bitboard::cell max_tile(bitboard::grid raw){
+		bitboard::cell max = 0;
+		for(;raw;raw>>=4) max = std::max<bitboard::cell>(max, raw & 0x0f);
+		return max;
+	}
+
+	float board_value(const features& f){
+		if(storage == fp16){
+			const std::vector<basic_weight<half>>& table = *half_net;
+			float value = 0;
+			for(size_t i=0;i<num_iso;i++){
+				value += table[f.base + iso_tuples[i].table][f[i]];
+			}
+			return value;
+		}
+		if(storage == int16){
+			const std::vector<basic_weight<int16_t>>& table = *fixed_net;
+			int32_t value = 0;
+			for(size_t i=0;i<num_iso;i++){
+				value += table[f.base + iso_tuples[i].table][f[i]];
+			}
+			return value * fixed_unit;
+		}
+		if(vectorized) return accumulate_avx2(f);
 		float value = 0;
-		
-		// rotate
-		int tuple_idx = 0;
-		for(auto tuple: iso_tuples){
-			int feature = 0;
-			for(auto idx: tuple){
-				feature <<= 4;
-				feature ^= b(idx);
+		for(size_t i=0;i<num_iso;i++){
+			value += net[f.base + iso_tuples[i].table][f[i]];
+		}
+		return value;
+	}
+
+	/**
+	 * AVX2 kernels, used if the CPU supports them (unless simd=0)
+	 * the 8 isomorphisms of a tuple are the 8 lanes of a vector, where each cell is taken from the packed board
+	 * by selecting its 32-bit half (permute) and a variable shift, and the entries are fetched by a single gather
+	 * the gathered entries are added in the same order as the scalar path, so that the value is bit-identical
+	 */
+	struct lanes {
+		int32_t word[6][8];
+		int32_t shift[6][8];
+	};
+	std::array<lanes, max_iso / 8> iso_lanes;
+
+	static bool simd(){
+#if defined(__x86_64__) || defined(__i386__)
+		static const bool avx2 = __builtin_cpu_supports("avx2");
+		return avx2;
+#else
+		return false;
+#endif
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	__attribute__((target("avx2")))
+	void extract_avx2(bitboard::grid raw, features& f) const {
+		const __m256i board = _mm256_set_epi32(0, 0, 0, 0, 0, 0, int32_t(raw >> 32), int32_t(raw));
+		const __m256i mask = _mm256_set1_epi32(0x0f);
+		for(size_t t=0;t<num_iso/8;t++){
+			const lanes& l = iso_lanes[t];
+			__m256i index = _mm256_setzero_si256();
+			for(size_t k=0;k<iso_tuples[t*8].size;k++){
+				__m256i word = _mm256_permutevar8x32_epi32(board, _mm256_loadu_si256((const __m256i*)l.word[k]));
+				__m256i cell = _mm256_and_si256(_mm256_srlv_epi32(word, _mm256_loadu_si256((const __m256i*)l.shift[k])), mask);
+				index = _mm256_or_si256(_mm256_slli_epi32(index, 4), cell);
 			}
-			value += net[tuple_idx++/8][feature];
+			_mm256_storeu_si256((__m256i*)&f.index[t*8], index);
 		}
+	}
 
+	__attribute__((target("avx2")))
+	float accumulate_avx2(const features& f){
+		float value = 0;
+		alignas(32) float entry[8];
+		for(size_t t=0;t<num_iso/8;t++){
+			const float* table = net[f.base + iso_tuples[t*8].table].data();
+			__m256i index = _mm256_loadu_si256((const __m256i*)&f.index[t*8]);
+			_mm256_store_ps(entry, _mm256_i32gather_ps(table, index, 4));
+			for(int r=0;r<8;r++) value += entry[r];
+		}
 		return value;
 	}
+#else
+	void extract_avx2(bitboard::grid raw, features& f) const {}
+	float accumulate_avx2(const features& f){ return 0; }
+#endif
 
-	void update_net(const board& b, float delta){
-		// rotate
-		int tuple_idx = 0;
-		for(auto tuple: iso_tuples){
-			int feature = 0;
-			for(auto idx: tuple){
-				feature <<= 4;
-				feature ^= b(idx);
+	float board_value(const bitboard& b, features& f){
+		extract(b, f);
+		return board_value(f);
+	}
+
+	float board_value(const bitboard& b){
+		features f;
+		return board_value(b, f);
+	}
+
+	/**
+	 * evaluate an afterstate, through the afterstate cache if it is enabled (vcache=B for 2^B buckets)
+	 * only the leaves of a search consult the cache, since the greedy moves and the updates rarely meet
+	 * the same afterstate twice
+	 */
+	float cached_value(const bitboard& b){
+		float value;
+		if(memo){
+			memo_lookups++;
+			if(memo->find(b, value)){
+				memo_hits++;
+				return value;
 			}
-			net[tuple_idx++/8][feature] += delta;
 		}
+		features f;
+		value = board_value(b, f);
+		if(memo) memo->store(b, value);
+		return value;
+	}
+
+	/**
+	 * evaluate a batch of afterstates, through the afterstate cache if it is enabled and cached is set
+	 * the features of a group of boards are all extracted and their entries prefetched before any of them
+	 * is accumulated, so that the cache misses of the independent lookups overlap
+	 * note that this has not been measured faster than board_value of each board, see bench.cpp
+	 * the features of each board are also returned in extracted if given, unless its value is found in the cache
+	 */
+	void evaluate(const bitboard* boards, size_t n, float* out, bool cached = false, features* extracted = nullptr){
+		const size_t group = 4;
+		features local[group];
+		features* f[group];
+		size_t pending[group];
+		afterstate_cache* memo = cached ? this->memo.get() : nullptr;
+		for(size_t s=0;s<n;s+=group){
+			size_t num = 0;
+			for(size_t i=s;i<std::min(n,s+group);i++){
+				if(memo){
+					memo_lookups++;
+					if(memo->find(boards[i], out[i])){
+						memo_hits++;
+						continue;
+					}
+				}
+				f[num] = extracted ? &extracted[i] : &local[num];
+				extract(boards[i], *f[num]);
+				prefetch(*f[num]);
+				pending[num++] = i;
+			}
+			for(size_t k=0;k<num;k++){
+				out[pending[k]] = board_value(*f[k]);
+				if(memo) memo->store(boards[pending[k]], out[pending[k]]);
+			}
+		}
+	}
+
+	void evaluate(const board* boards, size_t n, float* out){
+		const size_t group = 4;
+		bitboard b[group];
+		for(size_t s=0;s<n;s+=group){
+			size_t num = std::min(n-s,group);
+			for(size_t k=0;k<num;k++) b[k] = bitboard(boards[s+k]);
+			evaluate(b, num, out+s);
+		}
+	}
+
+	void prefetch(const features& f) const {
+		if(storage == fp16){
+			for(size_t i=0;i<num_iso;i++) __builtin_prefetch(&(*half_net)[f.base + iso_tuples[i].table][f[i]]);
+		} else if(storage == int16){
+			for(size_t i=0;i<num_iso;i++) __builtin_prefetch(&(*fixed_net)[f.base + iso_tuples[i].table][f[i]]);
+		} else {
+			for(size_t i=0;i<num_iso;i++) __builtin_prefetch(&net[f.base + iso_tuples[i].table][f[i]]);
+		}
+	}
+
+	void update_net(const features& f, float delta){
+		for(size_t i=0;i<num_iso;i++){
+			net[f.base + iso_tuples[i].table][f[i]] += delta;
+		}
+	}
+
+	void update_net(const bitboard& b, float delta){
+		features f;
+		extract(b, f);
+		update_net(f, delta);
 	}
 	
 	virtual void open_episode(const std::string& flag = "") {
 		stats.clear();
+		indices.clear();
 	}
 
 	virtual void close_episode(const std::string& flag = "") {
+		if(storage == fp32){ // quantized tables are for evaluation only
+			if(lambda >= 0) update_lambda();
+			else update_td0();
+			if(alpha != 0){
+				uint64_t episodes = trained->add(final_score);
+				if(ckpt && episodes % ckpt->every == 0) save_checkpoint(episodes);
+			}
+		}
+		if(memo){
+			memo->record(memo_hits, memo_lookups);
+			memo_hits = memo_lookups = 0;
+			if(alpha != 0) memo->invalidate(); // cached values are stale once the network is updated
+		}
+	}
+
+	/**
+	 * backward TD(0) over the afterstates of the episode
+	 */
+	void update_td0(){
 		int sz = stats.size();
-		float delta = -1.0f * alpha * board_value(stats[sz-1].next);
-		update_net(stats[sz-1].next, delta);
+		features next, prev;
+		float error = -board_value(stats[sz-1].next, next);
+		learn(next, error);
 		for(int i=sz-1;i>=1;i--){
-			float delta = alpha * (stats[i].reward + board_value(stats[i].next) - board_value(stats[i-1].next));
-			update_net(stats[i-1].next, delta);
+			extract(stats[i-1].next, prev);
+			float error = stats[i].reward + board_value(next) - board_value(prev);
+			learn(prev, error);
+			std::swap(next, prev);
+		}
+	}
+
+	/**
+	 * TD(lambda) by the lambda-return of each afterstate, enabled by lambda=L (and optionally horizon=N)
+	 *
+	 * the indices of each afterstate are extracted when the move is taken, and the whole episode is
+	 * updated in one backward sweep, i.e., a single evaluation and a single update per afterstate
+	 * the lambda-return is G(t) = r(t+1) + (1 - lambda) V(t+1) + lambda G(t+1), where G(T-1) = 0,
+	 * or the lambda-return truncated at N steps if the horizon is set
+	 */
+	void update_lambda(){
+		int sz = stats.size();
+		values.resize(sz);
+		float ret = 0;
+		for(int t=sz-1;t>=0;t--){
+			values[t] = board_value(indices[t]);
+			if(t == sz-1) ret = 0;
+			else if(horizon > 0) ret = truncated_return(t);
+			else ret = stats[t+1].reward + (1 - lambda) * values[t+1] + lambda * ret;
+			learn(indices[t], ret - values[t]);
+		}
+	}
+
+	float truncated_return(int t){
+		int sz = stats.size();
+		float target = 0, rewards = 0, scale = 1;
+		for(int k=1;;k++){
+			rewards += stats[t+k].reward;
+			float step = rewards + values[t+k];
+			if(k == horizon) return target + scale * step;
+			if(t+k == sz-1) return target + scale * ((1 - lambda) * step + lambda * rewards);
+			target += scale * (1 - lambda) * step;
+			scale *= lambda;
+		}
+	}
+
+	/**
+	 * adjust the weights of the features toward the TD error
+	 * by the global learning rate, or by the per-entry rate of temporal coherence learning if enabled
+	 */
+	void learn(const features& f, float error){
+		if(coherence) update_coherence(f, error);
+		else update_net(f, alpha * error);
+	}
+
+	/**
+	 * temporal coherence (TC) learning, enabled by tc=1
+	 * each entry has the accumulated error E and accumulated absolute error A, stored as an interleaved
+	 * (E, A) pair in a companion table, and is adjusted by alpha * |E| / A (or alpha if A is zero)
+	 * the companion tables are kept after the weight tables (of all stages), so they are shared and saved along with them
+	 */
+	void update_coherence(const features& f, float error){
+		size_t offset = tuples.size() * num_stages;
+		for(size_t i=0;i<num_iso;i++){
+			size_t t = f.base + iso_tuples[i].table;
+			weight::type* acc = &net[offset + t][2 * f[i]];
+			float rate = acc[1] != 0 ? std::fabs(acc[0]) / acc[1] : 1.0f;
+			net[t][f[i]] += alpha * rate * error;
+			acc[0] += error;
+			acc[1] += std::fabs(error);
+		}
+	}
+
+	void init_coherence(){
+		size_t num = tuples.size() * num_stages;
+		if(net.size() == num){
+			for(size_t t=0;t<num;t++) net.emplace_back(net[t].size() * 2);
+		}
+		if(net.size() != num * 2){
+			std::cerr << net.size() << " tables do not match " << num << " tables with TC accumulators" << std::endl;
+			std::exit(-1);
+		}
+	}
+
+	/**
+	 * periodic checkpoint in the background, enabled by checkpoint=every:N (optionally with path=P and eval=M)
+	 * every N training episodes, the tables are copied to a snapshot, which is saved to P (the save path by default,
+	 * with '#' replaced by the number of episodes) by a background thread while the training continues,
+	 * and is then evaluated by M greedy games (alpha=0) on the same thread, if eval is set
+	 */
+	void init_checkpoint(const std::string& info){
+		ckpt = std::make_shared<checkpoint>();
+		ckpt->every = std::stoull(info.substr(info.find(':') + 1));
+		if (meta.find("path") != meta.end()) ckpt->path = std::string(meta["path"]);
+		else if (meta.find("save") != meta.end()) ckpt->path = std::string(meta["save"]);
+		if (meta.find("eval") != meta.end()) ckpt->eval = int(meta["eval"]);
+		if (ckpt->every == 0 || ckpt->path.empty()) std::exit(-1);
+	}
+
+	void save_checkpoint(uint64_t episodes){
+		std::lock_guard<std::mutex> guard(ckpt->lock);
+		if (ckpt->writer.joinable()) ckpt->writer.join(); // the snapshot is reused once the previous one is written
+		std::vector<weight>& snapshot = *ckpt->snapshot;
+		snapshot.resize(net.size());
+		for (size_t t = 0; t < net.size(); t++) {
+			if (snapshot[t].size() != net[t].size()) snapshot[t] = weight(net[t].size());
+			std::copy(net[t].data(), net[t].data() + net[t].size(), snapshot[t].data());
+		}
+		weight::properties info = properties();
+		std::string path = ckpt->path;
+		for (size_t i; (i = path.find('#')) != std::string::npos; ) path.replace(i, 1, std::to_string(episodes));
+		std::shared_ptr<iso_weight_agent> judge;
+		if (ckpt->eval) {
+			judge.reset(new iso_weight_agent(*this, ckpt->snapshot));
+			judge->alpha = 0;
+			judge->memo.reset(); // the cached values are of the live tables
+			judge->ckpt.reset();
 		}
+		std::shared_ptr<std::vector<weight>> tables = ckpt->snapshot;
+		size_t games = ckpt->eval;
+		ckpt->writer = std::thread([=]() {
+			std::stringstream report;
+			report << "checkpoint: " << path << " (" << episodes << " episodes)";
+			if (!weight::save(path, *tables, info)) report << " cannot be saved";
+			else if (judge) report << ", avg = " << unsigned(judge->play(games)) << " (" << games << " games)";
+			std::cout << report.str() + "\n" << std::flush;
+		});
 	}
 
+	/**
+	 * play games against a random placer without learning, and return the average score
+	 */
+	double play(size_t games){
+		random_placer place;
+		double sum = 0;
+		for(size_t i=0;i<games;i++){
+			board b;
+			open_episode();
+			for(size_t step=0;;step++){
+				agent& who = step >= 9 && (step - 8) % 2 ? static_cast<agent&>(*this) : place;
+				if(who.take_action(b).apply(b) == -1) break;
+			}
+			sum += b.value();
+		}
+		return games ? sum / games : 0;
+	}
 
-	virtual action take_action(const board& before) {
+	/**
+	 * NUMA placement of the weight tables, numa=interleave to spread the pages over all nodes, or numa=local
+	 * the tables are shared by all threads and updated in place, hence they are interleaved rather than replicated
+	 */
+	void init_numa(const std::string& policy){
+		if(policy == "interleave") placement::interleave() = true;
+		else if(policy == "local") placement::interleave() = false;
+		else std::exit(-1);
+	}
+
+	/**
+	 * multi-stage network, enabled by stage=T1,T2,... (tile values in ascending order, e.g., stage=384,1536)
+	 * a board is at stage s if its largest tile reaches s of the thresholds, and each stage has its own tables,
+	 * i.e., stage s uses net[s * N] to net[s * N + N - 1] for N tuples
+	 */
+	void init_stages(const std::string& info){
+		std::string res = info;
+		for (char& ch : res)
+			if (!std::isdigit(ch)) ch = ' ';
+		std::stringstream in(res);
+		std::vector<unsigned> thresholds;
+		for (unsigned t; in >> t; thresholds.push_back(board::ttoi(t)))
+			stage_tiles += (stage_tiles.size() ? "," : "") + std::to_string(t);
+		num_stages = thresholds.size() + 1;
+		for(unsigned i=0;i<16;i++){
+			stage_of[i] = std::count_if(thresholds.begin(), thresholds.end(), [=](unsigned t) { return i >= t; });
+		}
+	}
+
+	/**
+	 * make sure that all stages have their tables, where layers is 2 if the TC accumulators follow the weights
+	 * a single-stage network (e.g., initialized by init=, or loaded from a single-stage file) is copied to every stage,
+	 * so that each stage starts from the same weights (and accumulators) and is then trained on its own positions
+	 */
+	void expand_stages(size_t layers){
+		size_t num = tuples.size();
+		if(net.size() == num * layers){
+			std::vector<weight> staged;
+			for(size_t l=0;l<layers;l++)
+				for(size_t s=0;s<num_stages;s++)
+					for(size_t t=0;t<num;t++) staged.push_back(weight(net[l * num + t]));
+			net.swap(staged);
+		}
+		if(net.size() != num * num_stages * layers){
+			std::cerr << net.size() << " tables do not match " << num_stages << " stage(s) of " << num << " tuples"
+				<< (layers == 2 ? " with TC accumulators" : "") << std::endl;
+			std::exit(-1);
+		}
+	}
+
+	/**
+	 * quantized tables for evaluation only, enabled by quant=fp16 or quant=int16 (requires alpha=0)
+	 * the float tables are converted once loaded and then released, so that board_value touches half the memory
+	 * int16 tables are fixed-point numbers, in units of the largest absolute weight / 32767
+	 */
+	void init_quantized(const std::string& type){
+		size_t num = tuples.size() * num_stages;
+		if(alpha != 0 || meta.find("save") != meta.end() || net.size() < num) std::exit(-1);
+		if(type == "fp16"){
+			half_net = std::make_shared<std::vector<basic_weight<half>>>(basic_weight<half>::convert(net, num));
+			storage = fp16;
+		} else if(type == "int16"){
+			float peak = 0;
+			for(size_t t=0;t<num;t++)
+				for(size_t i=0;i<net[t].size();i++) peak = std::max(peak, std::fabs(net[t][i]));
+			fixed_unit = peak > 0 ? peak / 32767 : 1;
+			fixed_net = std::make_shared<std::vector<basic_weight<int16_t>>>(basic_weight<int16_t>::convert(net, num, 1 / fixed_unit));
+			storage = int16;
+		} else {
+			std::exit(-1);
+		}
+		net.clear();
+		net.shrink_to_fit();
+	}
+
+	/**
+	 * record a move of the episode, along with the feature indices of its afterstate for TD(lambda),
+	 * which are extracted here unless they are already given
+	 */
+	void record(const bitboard& before, const bitboard& after, float reward, const features* extracted = nullptr){
+		stats.emplace_back(before, after, reward);
+		if(lambda >= 0){
+			if(extracted) indices.push_back(*extracted);
+			else {
+				indices.emplace_back();
+				extract(after, indices.back());
+			}
+		}
+	}
+
+	/**
+	 * whether the network is updated after each episode, i.e., alpha is not zero
+	 */
+	bool is_learning() const {
+		return alpha != 0;
+	}
+
+	/**
+	 * report the hit rate of the afterstate cache, or an empty string if it is disabled
+	 */
+	std::string cache_report(){
+		return memo ? memo->report() : "";
+	}
+
+
+	virtual action take_action(const board& b) {
+		const bitboard before(b);
 		float max_value = std::numeric_limits<float>::min();
 		float max_reward = -1;
-		int best_action = -1;
+		int best = -1;
 
+		bitboard after[4];
+		board::reward reward[4];
+		int op[4];
+		size_t n = 0;
 		for(auto i: {3, 2, 1, 0}){
-			board after(before);
-			board::reward reward = after.slide(i);
-			float total = reward + board_value(after);
-			if(reward != -1 and (total > max_value or max_value == std::numeric_limits<float>::min())){
-				max_reward = reward;
+			after[n] = before;
+			reward[n] = after[n].slide(i);
+			op[n] = i;
+			if(reward[n] != -1) n++;
+		}
+		float value[4];
+		features f[4];
+		evaluate(after, n, value, false, f);
+		for(size_t k=0;k<n;k++){
+			float total = reward[k] + value[k];
+			if(total > max_value or max_value == std::numeric_limits<float>::min()){
+				max_reward = reward[k];
 				max_value = total;
-				best_action = i;
+				best = k;
 			}
 		}
 
-		if(best_action != -1){
-			board after(before);
-			after.slide(best_action);
-			stats.emplace_back(before, after, max_reward);
-			return action::slide(best_action);
+		if(best != -1){
+			record(before, after[best], max_reward, &f[best]);
+			return action::slide(op[best]);
 		} else {
+			final_score = before.value();
 			return action();
 		}
 	}
 
 
 	virtual ~iso_weight_agent() {
-		if (meta.find("save") != meta.end())
+		if (meta.find("save") != meta.end()) {
+			if (ckpt) { // the checkpoint may be written to the same path
+				std::lock_guard<std::mutex> guard(ckpt->lock);
+				if (ckpt->writer.joinable()) ckpt->writer.join();
+			}
 			save_weights(meta["save"]);
+		}
 	}
 
 protected:
@@ -353,66 +997,456 @@ protected:
 		std::stringstream in(res);
 		for (size_t size; in >> size; net.emplace_back(size));
 	}
+	/**
+	 * load the weights, and check the network described by the file (if any) against this agent,
+	 * so that a mismatched network fails immediately instead of being evaluated as garbage
+	 * the tuples and the stages must match, except that a single-stage network is copied to every stage,
+	 * and the TC accumulators are dropped without tc=1 (unless saving), or are started from zero with tc=1
+	 */
 	virtual void load_weights(const std::string& path) {
-		std::ifstream in(path, std::ios::in | std::ios::binary);
-		if (!in.is_open()) std::exit(-1);
-		uint32_t size;
-		in.read(reinterpret_cast<char*>(&size), sizeof(size));
-		net.resize(size);
-		for (weight& w : net) in >> w;
-		in.close();
+		weight::properties info;
+		if (!weight::load(path, net, &info)) {
+			std::cerr << path << ": cannot load the weights, or the checksum does not match" << std::endl;
+			std::exit(-1);
+		}
+		if (info.count("tuples") && info["tuples"] != tuple_info()) {
+			std::cerr << path << ": the tuples " << info["tuples"] << " do not match " << tuple_info() << std::endl;
+			std::exit(-1);
+		}
+		if (info.count("stage") && info["stage"].size() && info["stage"] != stage_tiles) {
+			std::cerr << path << ": the stages " << info["stage"] << " do not match " << (stage_tiles.size() ? stage_tiles : "a single stage") << std::endl;
+			std::exit(-1);
+		}
+		// the layout of the file, i.e., its number of stages, and whether the TC accumulators follow the weights
+		// which is described by the header, or otherwise tried with the configuration of this agent first
+		std::vector<size_t> stage_options = { num_stages, 1 }, layer_options = { coherence ? 2u : 1u, coherence ? 1u : 2u };
+		if (info.count("stage")) // an empty stage is a single-stage network, which is copied to every stage
+			stage_options = { info["stage"].empty() ? 1 : size_t(std::count(info["stage"].begin(), info["stage"].end(), ',') + 2) };
+		if (info.count("tc"))
+			layer_options = { info["tc"] != "0" ? 2u : 1u };
+		if (info.count("tc") && info["tc"] != "0" && !coherence && meta.find("save") != meta.end()) {
+			std::cerr << path << ": the network has TC accumulators, which would be lost by saving without tc=1" << std::endl;
+			std::exit(-1);
+		}
+		size_t num = tuples.size(), stages = 0, layers = 0;
+		for (size_t s : stage_options) {
+			for (size_t l : layer_options) {
+				if (!stages && net.size() == num * s * l) stages = s, layers = l;
+			}
+		}
+		if (!stages) {
+			std::cerr << path << ": " << net.size() << " tables do not match " << num_stages << " stage(s) of " << num << " tuples" << std::endl;
+			std::exit(-1);
+		}
+		if (layers == 2 && !coherence) { // the accumulators are only for training with tc=1
+			net.resize(num * stages);
+			layers = 1;
+		}
+		if (stages != num_stages) expand_stages(layers);
+		trained->resume(info.count("episodes") ? std::stoull(info["episodes"]) : 0, info.count("average") ? std::stod(info["average"]) : 0);
 	}
 	virtual void save_weights(const std::string& path) {
-		std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
-		if (!out.is_open()) std::exit(-1);
-		uint32_t size = net.size();
-		out.write(reinterpret_cast<char*>(&size), sizeof(size));
-		for (weight& w : net) out << w;
-		out.close();
+		if (!weight::save(path, net, properties())) std::exit(-1);
 	}
 
+	weight::properties properties() {
+		weight::properties info;
+		info["tuples"] = tuple_info();
+		info["stage"] = stage_tiles;
+		info["tc"] = std::to_string(int(coherence));
+		std::lock_guard<std::mutex> guard(trained->lock);
+		info["episodes"] = std::to_string(trained->episodes);
+		info["average"] = std::to_string(trained->average);
+		return info;
+	}
+
+	/**
+	 * the tuple patterns, e.g., "0,1,2,4,5,6 1,2,5,6,9,13"
+	 */
+	std::string tuple_info() const {
+		std::string info;
+		for(const auto& tuple : tuples){
+			if(info.size()) info += " ";
+			for(size_t k=0;k<tuple.size();k++) info += (k ? "," : "") + std::to_string(tuple[k]);
+		}
+		return info;
+	}
+
+	/**
+	 * the training progress, shared by all workers and saved along with the weights,
+	 * i.e., the number of training episodes and the average score of the last (up to) 1000 episodes
+	 * the scores are kept in a ring buffer with their running sum; since only the average is saved,
+	 * a resumed training starts with a window filled with the saved average
+	 */
+	struct progress {
+		std::mutex lock;
+		uint64_t episodes = 0;
+		double average = 0;
+		uint64_t add(unsigned score) {
+			std::lock_guard<std::mutex> guard(lock);
+			episodes++;
+			push(score);
+			return episodes;
+		}
+		void resume(uint64_t trained, double score) {
+			std::lock_guard<std::mutex> guard(lock);
+			episodes = trained;
+			average = sum = 0;
+			filled = next = 0;
+			for (uint64_t i = 0; i < std::min<uint64_t>(trained, recent.size()); i++) push(score);
+		}
+
+	private:
+		void push(double score) {
+			if (filled == recent.size()) sum -= recent[next];
+			else filled++;
+			recent[next] = score;
+			next = (next + 1) % recent.size();
+			sum += score;
+			average = sum / filled;
+		}
+		std::vector<double> recent = std::vector<double>(1000);
+		size_t filled = 0, next = 0;
+		double sum = 0;
+	};
+
+	/**
+	 * periodic checkpoint, shared by all workers, see init_checkpoint
+	 */
+	struct checkpoint {
+		uint64_t every = 0;
+		std::string path;
+		size_t eval = 0;
+		std::shared_ptr<std::vector<weight>> snapshot = std::make_shared<std::vector<weight>>();
+		std::thread writer;
+		std::mutex lock;
+		~checkpoint() { if (writer.joinable()) writer.join(); }
+	};
+
 protected:
-	std::vector<weight> net;
+	std::shared_ptr<std::vector<weight>> shared;
+	std::vector<weight>& net;
 	std::vector<state> stats;
 	float alpha;
+	std::shared_ptr<progress> trained;
+	unsigned final_score = 0;
+	std::shared_ptr<afterstate_cache> memo;
+	std::shared_ptr<checkpoint> ckpt;
+	size_t memo_hits = 0;
+	size_t memo_lookups = 0;
+	float lambda = -1; // TD(0) if negative
+	int horizon = 0;
+	bool coherence = false;
+	size_t num_stages = 1;
+	std::array<uint8_t, 16> stage_of = {}; // stage by the largest tile (index)
+	std::string stage_tiles; // the thresholds, e.g., "384,1536"
+	enum { fp32, fp16, int16 } storage = fp32;
+	std::shared_ptr<const std::vector<basic_weight<half>>> half_net;
+	std::shared_ptr<const std::vector<basic_weight<int16_t>>> fixed_net;
+	float fixed_unit = 1;
+	bool vectorized = simd();
+	bool compiled = false;
+	std::vector<features> indices;
+	std::vector<float> values;
 };
 
 /**
- * default random environment, i.e., placer
- * place the hint tile and decide a new hint tile
+ * expectimax slider on top of the n-tuple network
+ * search N plies of slider moves and placer chance nodes, and evaluate the leaves by the network
+ *
+ * arguments: depth=N (plies of slider moves, depth=1 is the greedy iso_weight_agent)
+ *            time=T (per-move budget in milliseconds, 0 for unlimited; depth 1 is always completed)
+ *            cache=B (the transposition cache has 2^B entries, 1 <= B <= 30, only if depth > 1)
+ *            vcache=B (the afterstate cache of the leaves has 2^B buckets, 1 <= B <= 30, which requires depth > 1)
  */
-class random_placer : public random_agent {
+class expectimax_slider : public iso_weight_agent {
 public:
-	random_placer(const std::string& args = "") : random_agent("name=place role=placer " + args) {
-		spaces[0] = { 12, 13, 14, 15 };
-		spaces[1] = { 0, 4, 8, 12 };
-		spaces[2] = { 0, 1, 2, 3};
-		spaces[3] = { 3, 7, 11, 15 };
-		spaces[4] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+	expectimax_slider(const std::string& args = "") : iso_weight_agent(args), depth(1), budget(0), generation(1) {
+		init_search();
 	}
 
-	virtual action take_action(const board& after) {
-		std::vector<int> space = spaces[after.last()];
-		std::shuffle(space.begin(), space.end(), engine);
-		for (int pos : space) {
-			if (after(pos) != 0) continue;
+	/**
+	 * create a worker for parallel training, see iso_weight_agent
+	 */
+	expectimax_slider(const expectimax_slider& master) : iso_weight_agent(master),
+		depth(master.depth), budget(master.budget), generation(1) {
+		init_cache(master.cache_bits);
+	}
 
-			int bag[3], num = 0;
-			for (board::cell t = 1; t <= 3; t++)
-				for (size_t i = 0; i < after.bag(t); i++)
-					bag[num++] = t;
-			std::shuffle(bag, bag + num, engine);
+protected:
+	/**
+	 * create a searcher of its own arguments on the tables of another agent, see iso_weight_agent
+	 */
+	expectimax_slider(const std::string& args, const iso_weight_agent& network) : iso_weight_agent(args, network),
+		depth(1), budget(0), generation(1) {
+		init_search();
+	}
 
-			board::cell tile = after.hint() ?: bag[--num];
-			board::cell hint = bag[--num];
+	void init_search() {
+		if (meta.find("depth") != meta.end())
+			depth = int(meta["depth"]);
+		if (meta.find("time") != meta.end())
+			budget = int(meta["time"]);
+		auto bits_of = [&](const std::string& key, int bits) -> unsigned { // the size of a cache in bits, 1 to 30
+			if (meta.find(key) != meta.end()) bits = int(meta[key]);
+			if (bits < 1 || bits > 30) {
+				std::cerr << key << "=" << bits << " is out of range, a cache has 2^1 to 2^30 entries" << std::endl;
+				std::exit(-1);
+			}
+			return unsigned(bits);
+		};
+		init_cache(bits_of("cache", 18));
+		if (meta.find("vcache") != meta.end()) { // only the leaves of a deeper search consult the cache
+			if (depth <= 1) {
+				std::cerr << "vcache=" << std::string(meta["vcache"]) << " needs depth > 1, the greedy slider does not consult the cache" << std::endl;
+				std::exit(-1);
+			}
+			memo = std::make_shared<afterstate_cache>(bits_of("vcache", 0));
+		}
+	}
 
-			return action::place(pos, tile, hint);
+public:
+	virtual void close_episode(const std::string& flag = "") {
+		iso_weight_agent::close_episode(flag);
+		if (alpha != 0) generation++; // cached values are stale once the network is updated
+	}
+
+	virtual action take_action(const board& b) {
+		if (depth <= 1) return iso_weight_agent::take_action(b);
+		const bitboard before(b);
+		start = std::chrono::steady_clock::now();
+		nodes = 0;
+		aborted = false;
+
+		int best_action = -1;
+		float best_reward = -1;
+		for (int d = 1; d <= depth && !aborted; d++) { // iterative deepening
+			float max_value = 0;
+			float max_reward = -1;
+			int max_action = -1;
+			for (auto i: {3, 2, 1, 0}) {
+				bitboard after(before);
+				board::reward reward = after.slide(i);
+				if (reward == -1) continue;
+				float total = reward + expect(after, d);
+				if (aborted) break;
+				if (max_action == -1 || total > max_value) {
+					max_reward = reward;
+					max_value = total;
+					max_action = i;
+				}
+			}
+			if (aborted) break;
+			best_action = max_action;
+			best_reward = max_reward;
+		}
+
+		if (best_action != -1) {
+			bitboard after(before);
+			after.slide(best_action);
+			record(before, after, best_reward);
+			return action::slide(best_action);
+		} else {
+			final_score = before.value();
+			return action();
 		}
-		return action();
 	}
 
-private:
-	std::vector<int> spaces[5];
+protected:
+	/**
+	 * chance node: the placer puts the hint tile on an empty cell of the side opposite to the last slide,
+	 * and draws the next hint from the bag, following random_placer
+	 */
+	virtual float expect(const bitboard& after, int d) {
+		if (d <= 1) return cached_value(after);
+		float value;
+		if (find_cache(after, d, 1, value)) return value;
+		if (timeout()) return 0;
+
+		float sum = 0;
+		size_t count = random_placer::enumerate(after, [&](unsigned pos, unsigned tile, unsigned hint, float prob) {
+			bitboard next(after);
+			next.place(pos, tile, hint);
+			sum += prob * search(next, d - 1);
+		});
+		value = count ? sum : board_value(after);
+		if (!aborted) store_cache(after, d, 1, value);
+		return value;
+	}
+
+	/**
+	 * max node: the slider takes the move with the highest reward plus expected value
+	 * a state without legal moves is terminal and is worth nothing
+	 */
+	float search(const bitboard& before, int d) {
+		float value;
+		if (find_cache(before, d, 0, value)) return value;
+		bitboard after[4];
+		board::reward reward[4];
+		size_t n = 0;
+		for (auto i: {3, 2, 1, 0}) {
+			after[n] = before;
+			reward[n] = after[n].slide(i);
+			if (reward[n] != -1) n++;
+		}
+		float leaf[4];
+		if (d <= 1) evaluate(after, n, leaf, true); // the leaves of the 4 moves are looked up together
+		value = 0;
+		for (size_t k = 0; k < n; k++) {
+			float total = reward[k] + (d <= 1 ? leaf[k] : expect(after[k], d));
+			if (k == 0 || total > value) value = total;
+		}
+		if (!aborted) store_cache(before, d, 0, value);
+		return value;
+	}
+
+	bool timeout() {
+		if (budget == 0 || (++nodes & 0xff)) return aborted;
+		auto elapsed = std::chrono::steady_clock::now() - start;
+		aborted |= elapsed >= std::chrono::milliseconds(budget);
+		return aborted;
+	}
+
+protected:
+	/**
+	 * direct-mapped transposition cache of node values
+	 * an entry is keyed on the packed tiles, the hint/bag/last info, the remaining depth, the node type,
+	 * and the generation of the network
+	 * the cache is only allocated if depth > 1, otherwise the lookups always miss
+	 */
+	struct entry {
+		bitboard::grid raw;
+		uint64_t tag;
+		float value;
+	};
+
+	void init_cache(unsigned bits) {
+		cache_bits = bits;
+		if (depth > 1) cache.assign(size_t(1) << bits, entry{ 0, 0, 0 }); // a greedy search revisits no node
+	}
+	uint64_t cache_tag(const bitboard& b, int d, int chance) const {
+		return (b.info() & 0xfffff) | (uint64_t(d & 0xff) << 20) | (uint64_t(chance) << 28) | (generation << 32);
+	}
+	entry& cache_slot(const bitboard& b, uint64_t tag) {
+		uint64_t hash = (b.raw() ^ (tag * 0x9e3779b97f4a7c15ull)) * 0xbf58476d1ce4e5b9ull;
+		return cache[hash >> (64 - cache_bits)];
+	}
+	bool find_cache(const bitboard& b, int d, int chance, float& value) {
+		if (cache.empty()) return false;
+		uint64_t tag = cache_tag(b, d, chance);
+		const entry& e = cache_slot(b, tag);
+		if (e.raw != b.raw() || e.tag != tag) return false;
+		value = e.value;
+		return true;
+	}
+	void store_cache(const bitboard& b, int d, int chance, float value) {
+		if (cache.empty()) return;
+		uint64_t tag = cache_tag(b, d, chance);
+		cache_slot(b, tag) = { b.raw(), tag, value };
+	}
+
+protected:
+	int depth;
+	int budget;
+	uint64_t generation;
+	unsigned cache_bits;
+	std::vector<entry> cache;
+	std::chrono::steady_clock::time_point start;
+	size_t nodes;
+	bool aborted;
+};
+
+/**
+ * adversarial environment, i.e., placer, on top of the n-tuple network
+ * place the tile that minimizes the value of the slider, under the same bag constraints as random_placer,
+ * by searching N plies of slider moves and placements, where the leaves are evaluated by the network
+ * note that the 9 initial placements are also chosen as if the slider moves next
+ *
+ * arguments: search=adversarial (selects this placer in threes.cpp)
+ *            depth=N, time=T, cache=B (see expectimax_slider), and the network arguments, e.g., load=weights.bin
+ *            (threes.cpp attacks the network of the slider on its own tables, unless another file is loaded)
+ */
+class adversarial_placer : public expectimax_slider {
+public:
+	adversarial_placer(const std::string& args = "") : expectimax_slider("name=place role=placer " + args) {
+		check_network();
+	}
+
+	/**
+	 * create a placer attacking the network of the given agent, sharing its tables
+	 */
+	adversarial_placer(const std::string& args, const iso_weight_agent& network) :
+		expectimax_slider("name=place role=placer " + args, network) {
+		check_network();
+	}
+
+	/**
+	 * create a worker for parallel games, which shares the weight tables with the master
+	 */
+	adversarial_placer(const adversarial_placer& master) : expectimax_slider(master) {}
+
+	virtual void open_episode(const std::string& flag = "") {
+		generation++; // the shared tables may have been trained since the last episode
+	}
+	virtual void close_episode(const std::string& flag = "") {} // the placer never learns
+
+	virtual action take_action(const board& b) {
+		const bitboard after(b);
+		start = std::chrono::steady_clock::now();
+		nodes = 0;
+		aborted = false;
+
+		action best;
+		for (int d = 1; d <= std::max(depth, 1) && !aborted; d++) { // iterative deepening
+			float min_value = 0;
+			action min_action;
+			bool placed = false;
+			random_placer::enumerate(after, [&](unsigned pos, unsigned tile, unsigned hint, float) {
+				if (aborted) return;
+				bitboard next(after);
+				next.place(pos, tile, hint);
+				float value = search(next, d);
+				if (!placed || value < min_value) {
+					placed = true;
+					min_value = value;
+					min_action = action::place(pos, tile, hint);
+				}
+			});
+			if (aborted) break;
+			best = min_action;
+		}
+		return best;
+	}
+
+protected:
+	void check_network() const {
+		if (storage == fp32 && net.size() < tuples.size() * num_stages) {
+			std::cerr << "the adversarial placer needs a network, e.g., load=weights.bin" << std::endl;
+			std::exit(-1);
+		}
+	}
+
+	/**
+	 * min node: the placer takes the placement with the lowest value for the slider
+	 */
+	virtual float expect(const bitboard& after, int d) {
+		if (d <= 1) return cached_value(after);
+		float value;
+		if (find_cache(after, d, 1, value)) return value;
+		if (timeout()) return 0;
+
+		bool placed = false;
+		random_placer::enumerate(after, [&](unsigned pos, unsigned tile, unsigned hint, float) {
+			bitboard next(after);
+			next.place(pos, tile, hint);
+			float v = search(next, d - 1);
+			if (!placed || v < value) value = v;
+			placed = true;
+		});
+		if (!placed) value = board_value(after);
+		if (!aborted) store_cache(after, d, 1, value);
+		return value;
+	}
 };
 
 /**
@@ -424,10 +1458,11 @@ public:
 	random_slider(const std::string& args = "") : random_agent("name=slide role=slider " + args),
 		opcode({ 0, 1, 2, 3 }) {}
 
-	virtual action take_action(const board& before) {
-		std::shuffle(opcode.begin(), opcode.end(), engine);
+	virtual action take_action(const board& b) {
+		const bitboard before(b);
+		engine.shuffle(opcode.begin(), opcode.end());
 		for (int op : opcode) {
-			board::reward reward = board(before).slide(op);
+			board::reward reward = bitboard(before).slide(op);
 			if (reward != -1) return action::slide(op);
 		}
 		return action();
@@ -443,11 +1478,12 @@ public:
 	vanilla_greedy_slider(const std::string& args = "") : random_agent("name=slide role=slider " + args),
 		opcode({ 0, 1, 2, 3 }) {}
 
-	virtual action take_action(const board& before) {
+	virtual action take_action(const board& b) {
+		const bitboard before(b);
 		board::reward max_reward = -1;
 		int max_op;
 		for (int op : opcode) {
-			board::reward reward = board(before).slide(op);
+			board::reward reward = bitboard(before).slide(op);
 			if(reward >= max_reward){
 				max_reward = reward;
 				max_op = op;
@@ -470,11 +1506,12 @@ public:
 	forbid_greedy_slider(const std::string& args = "") : random_agent("name=slide role=slider " + args),
 		opcode({ 0, 1, 3 }), alter_opcode({ 2 }) {}
 
-	virtual action take_action(const board& before) {
+	virtual action take_action(const board& b) {
+		const bitboard before(b);
 		board::reward max_reward = -1;
 		int max_op;
 		for (int op : opcode) {
-			board::reward reward = board(before).slide(op);
+			board::reward reward = bitboard(before).slide(op);
 			if(reward >= max_reward){
 				max_reward = reward;
 				max_op = op;
@@ -483,7 +1520,7 @@ public:
 		if(max_reward == -1){
 			max_reward = -1;
 			for (int op : alter_opcode) {
-				board::reward reward = board(before).slide(op);
+				board::reward reward = bitboard(before).slide(op);
 				if(reward >= max_reward){
 					max_reward = reward;
 					max_op = op;
@@ -512,11 +1549,12 @@ public:
 	greedy_slider(const std::string& args = "") : random_agent("name=slide role=slider " + args),
 		opcode({ 1, 2 }), alter_opcode({3, 0}) {}
 
-	virtual action take_action(const board& before) {
+	virtual action take_action(const board& b) {
+		const bitboard before(b);
 		board::reward max_reward = -1;
 		int max_op;
 		for (int op : opcode) {
-			board::reward reward = board(before).slide(op);
+			board::reward reward = bitboard(before).slide(op);
 			if(reward >= max_reward){
 				max_reward = reward;
 				max_op = op;
@@ -525,7 +1563,7 @@ public:
 		if(max_reward == -1){
 			max_reward = -1;
 			for (int op : alter_opcode) {
-				board::reward reward = board(before).slide(op);
+				board::reward reward = bitboard(before).slide(op);
 				if(reward >= max_reward){
 					max_reward = reward;
 					max_op = op;
@@ -0,0 +1,238 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * bench.cpp: Micro-benchmarks of the board and agent hot paths
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include "board.h"
+#include "bitboard.h"
+#include "action.h"
+#include "agent.h"
+
+/**
+ * run each benchmark on a fixed set of positions, and report the median ns/op over the repetitions
+ * a benchmark is first warmed up for at least 20 ms with doubling iterations, then each repetition
+ * runs as many iterations as take about 10 ms at the fastest warm-up speed
+ */
+class benchmark {
+public:
+	benchmark(size_t reps, const std::string& filter) : reps(reps), filter(filter), sink(0) {}
+
+	template<typename body>
+	void run(const std::string& name, size_t ops, body f) {
+		if (name.find(filter) == std::string::npos) return;
+		typedef std::chrono::steady_clock clock;
+		size_t iters = 1;
+		double fastest = 0; // ns per iteration
+		for (double warmup = 0; warmup < 2e7; iters *= 2) {
+			auto start = clock::now();
+			for (size_t i = 0; i < iters; i++) sink += f();
+			double elapsed = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+			fastest = (warmup == 0) ? elapsed / iters : std::min(fastest, elapsed / iters);
+			warmup += elapsed;
+		}
+		iters = std::max(size_t(1e7 / fastest), size_t(1));
+		std::vector<double> times;
+		for (size_t r = 0; r < reps; r++) {
+			auto start = clock::now();
+			for (size_t i = 0; i < iters; i++) sink += f();
+			times.push_back(std::chrono::duration<double, std::nano>(clock::now() - start).count() / (iters * ops));
+		}
+		std::sort(times.begin(), times.end());
+		results.push_back({ name, times[times.size() / 2], times.front(), iters * ops, reps });
+	}
+
+	void report(std::ostream& out, const std::string& format) const {
+		out << std::fixed << std::setprecision(2);
+		if (format == "json") {
+			out << "[" << std::endl;
+			for (size_t i = 0; i < results.size(); i++) {
+				const result& r = results[i];
+				out << "  { \"benchmark\": \"" << r.name << "\", \"ns_per_op\": " << r.median << ", \"min_ns_per_op\": " << r.min
+					<< ", \"ops\": " << r.ops << ", \"reps\": " << r.reps << " }" << (i + 1 < results.size() ? "," : "") << std::endl;
+			}
+			out << "]" << std::endl;
+		} else {
+			out << "benchmark,ns_per_op,min_ns_per_op,ops,reps" << std::endl;
+			for (const result& r : results)
+				out << r.name << "," << r.median << "," << r.min << "," << r.ops << "," << r.reps << std::endl;
+		}
+	}
+
+private:
+	struct result {
+		std::string name;
+		double median, min;
+		size_t ops, reps;
+	};
+	size_t reps;
+	std::string filter;
+	std::vector<result> results;
+
+public:
+	volatile double sink; // keeps the results alive
+};
+
+int main(int argc, const char* argv[]) {
+	size_t reps = 5, positions = 1024;
+	std::string format = "csv", filter, load_path;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		auto match_arg = [&](std::string flag) -> bool {
+			auto it = arg.find_first_not_of('-');
+			return arg.find(flag, it) == it;
+		};
+		auto next_opt = [&]() -> std::string {
+			auto it = arg.find('=') + 1;
+			return it ? arg.substr(it) : argv[++i];
+		};
+		if (match_arg("reps")) {
+			reps = std::stoull(next_opt());
+		} else if (match_arg("positions")) {
+			positions = std::stoull(next_opt());
+		} else if (match_arg("format")) {
+			format = next_opt();
+		} else if (match_arg("filter")) {
+			filter = next_opt();
+		} else if (match_arg("load")) {
+			load_path = next_opt();
+		}
+	}
+
+	// canned positions, collected from games of a seeded random slider and placer
+	std::vector<board> befores, afters;
+	std::vector<action> places;
+	random_slider slider("seed=1");
+	random_placer placer("seed=2");
+	board b;
+	auto restart = [&]() { // a new game starts with 9 placements
+		b = board();
+		for (int i = 0; i < 9; i++) placer.take_action(b).apply(b);
+	};
+	for (restart(); befores.size() < positions; ) {
+		board before = b;
+		if (slider.take_action(b).apply(b) == -1) { restart(); continue; }
+		board after = b;
+		action place = placer.take_action(b);
+		if (place.apply(b) == -1) { restart(); continue; }
+		befores.push_back(before);
+		afters.push_back(after);
+		places.push_back(place);
+	}
+	std::vector<bitboard> bit_befores(befores.begin(), befores.end()), bit_afters(afters.begin(), afters.end());
+
+	benchmark bench(reps, filter);
+
+	bench.run("board::slide", positions * 4, [&]() {
+		board::reward total = 0;
+		for (const board& b : befores)
+			for (unsigned op = 0; op < 4; op++) total += board(b).slide(op);
+		return total;
+	});
+	bench.run("bitboard::slide", positions * 4, [&]() {
+		board::reward total = 0;
+		for (const bitboard& b : bit_befores)
+			for (unsigned op = 0; op < 4; op++) total += bitboard(b).slide(op);
+		return total;
+	});
+	bench.run("board::place", positions, [&]() {
+		board::reward total = 0;
+		for (size_t i = 0; i < positions; i++) {
+			action::place move(places[i]);
+			board b(afters[i]);
+			total += b.place(move.position(), move.tile(), move.hint());
+		}
+		return total;
+	});
+	bench.run("bitboard::place", positions, [&]() {
+		board::reward total = 0;
+		for (size_t i = 0; i < positions; i++) {
+			action::place move(places[i]);
+			bitboard b(bit_afters[i]);
+			total += b.place(move.position(), move.tile(), move.hint());
+		}
+		return total;
+	});
+	bench.run("action::apply", positions, [&]() {
+		board::reward total = 0;
+		for (size_t i = 0; i < positions; i++) {
+			board b(afters[i]);
+			total += places[i].apply(b);
+		}
+		return total;
+	});
+	bench.run("random_placer::enumerate", positions, [&]() {
+		size_t total = 0;
+		for (const bitboard& b : bit_afters)
+			total += random_placer::enumerate(b, [](unsigned pos, unsigned tile, unsigned hint, float prob) {});
+		return total;
+	});
+	bench.run("random_placer::take_action", positions, [&]() {
+		unsigned total = 0;
+		placer.open_episode();
+		for (const board& b : afters) total += placer.take_action(b);
+		return total;
+	});
+	bench.run("rng::shuffle(16)", positions, [&]() {
+		int cells[16] = { 0 };
+		rng engine;
+		engine.seed({ 3 });
+		for (size_t i = 0; i < positions; i++) engine.shuffle(cells, cells + 16);
+		return cells[0];
+	});
+
+	// the network of the default slider, either loaded or filled with fixed pseudo-random weights,
+	// so that every page of the tables is backed by memory as with a trained network
+	// the searcher of depth 2 shares the tables, and its transposition cache is cleared before each run
+	class bench_slider : public expectimax_slider {
+	public:
+		bench_slider(const std::string& args) : expectimax_slider(args) {}
+		bench_slider(const std::string& args, const bench_slider& network) : expectimax_slider(args, network) {}
+		void fill(uint64_t seed) {
+			rng engine;
+			engine.seed({ seed });
+			for (weight& w : net)
+				for (size_t i = 0; i < w.size(); i++) w[i] = engine.below(65536) / 65536.0f;
+		}
+		void forget() { generation++; }
+	};
+	bench_slider network(load_path.size() ? "alpha=0 load=" + load_path : "alpha=0 init=16777216,16777216,16777216,16777216");
+	if (load_path.empty()) network.fill(4);
+	bench_slider searcher("depth=2", network);
+
+	bench.run("iso_weight_agent::board_value", positions, [&]() {
+		float total = 0;
+		for (const bitboard& b : bit_afters) total += network.board_value(b);
+		return total;
+	});
+	std::vector<float> values(positions);
+	bench.run("iso_weight_agent::evaluate", positions, [&]() {
+		network.evaluate(bit_afters.data(), positions, values.data());
+		return values[0];
+	});
+	bench.run("expectimax_slider::take_action(depth=1)", positions, [&]() {
+		unsigned total = 0;
+		network.open_episode();
+		for (const board& b : befores) total += network.take_action(b);
+		return total;
+	});
+	bench.run("expectimax_slider::take_action(depth=2)", positions, [&]() {
+		unsigned total = 0;
+		searcher.forget();
+		searcher.open_episode();
+		for (const board& b : befores) total += searcher.take_action(b);
+		return total;
+	});
+
+	bench.report(std::cout, format);
+	return 0;
+}
@@ -0,0 +1,278 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * bitboard.h: Define the packed 64-bit game state of the game of Threes!
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <cstdint>
+#include <array>
+#include <iostream>
+#include "board.h"
+
+/**
+ * bitboard-based board for Threes!
+ * shares the public interface of board, but packs the 16 tiles into a single 64-bit integer
+ *
+ * index (1-d form), each cell occupies 4 bits, i.e., cell (i) is stored in bits [4i, 4i + 4):
+ *  (0)  (1)  (2)  (3)
+ *  (4)  (5)  (6)  (7)
+ *  (8)  (9) (10) (11)
+ * (12) (13) (14) (15)
+ *
+ * row (r) is therefore the 16-bit word at bits [16r, 16r + 16), with cell (4r) in its lowest nibble
+ * note that a tile index never exceeds 14, so 4 bits per cell are sufficient
+ *
+ * sliding is table-driven: the result and reward of all 65536 rows in both horizontal directions
+ * are precomputed at startup, and vertical slides are done by transposing the board
+ */
+class bitboard {
+public:
+	typedef board::cell cell;
+	typedef uint16_t row;
+	typedef uint64_t grid;
+	typedef board::data data;
+	typedef board::score score;
+	typedef board::reward reward;
+
+	/**
+	 * proxy of a single cell, so that b(i) = t works as with board
+	 */
+	class reference {
+	public:
+		reference(grid& raw, unsigned i) : raw(raw), shift(i << 2) {}
+		operator cell() const { return (raw >> shift) & 0x0f; }
+		reference& operator =(cell t) { raw = (raw & ~(grid(0x0f) << shift)) | (grid(t & 0x0f) << shift); return *this; }
+		reference& operator =(const reference& r) { return operator =(cell(r)); }
+	private:
+		grid& raw;
+		unsigned shift;
+	};
+
+public:
+	bitboard() : tile(0), attr(0) { reset(); }
+	bitboard(grid b, data v) : tile(b), attr(v) {}
+	bitboard(const board& b) : tile(0), attr(b.info()) {
+		for (unsigned i = 0; i < 16; i++) tile |= grid(b(i) & 0x0f) << (i << 2);
+	}
+	bitboard(const bitboard& b) = default;
+	bitboard& operator =(const bitboard& b) = default;
+
+	operator board() const {
+		board b({}, attr);
+		for (unsigned i = 0; i < 16; i++) b(i) = operator()(i);
+		return b;
+	}
+
+	grid raw() const { return tile; }
+	grid raw(grid b) { grid old = tile; tile = b; return old; }
+	row operator [](unsigned r) const { return row(tile >> (r << 4)); }
+	reference operator ()(unsigned i) { return reference(tile, i); }
+	cell operator ()(unsigned i) const { return (tile >> (i << 2)) & 0x0f; }
+
+	data info() const { return attr; }
+	data info(data dat) { data old = attr; attr = dat; return old; }
+
+private:
+	data info4(size_t i) const { return (info() >> (4 * i)) & 0x0fu; }
+	data info4(size_t i, data dat) { data old = info4(i); info(info() ^ ((old ^ dat) << (4 * i))); return old; }
+
+public:
+	cell hint() const { return info4(0); }
+	cell hint(cell t) { return info4(0, t); }
+	unsigned last() const { return info4(1); }
+	unsigned last(unsigned a) { return info4(1, a); }
+	unsigned bag(cell t) const { return info4(t + 1); }
+	unsigned bag(cell t, unsigned n) { return info4(t + 1, n); }
+
+	void reset() {
+		hint(0);
+		last(4);
+		reset_bag();
+	}
+	void reset_bag() {
+		for (cell t = 1; t <= 3; t++) bag(t, 1);
+	}
+	bool extract_hint_from_bag(cell t) {
+		if (bag(t) < 1) return false;
+		bag(t, bag(t) - 1);
+		if (bag(1) + bag(2) + bag(3) == 0) reset_bag();
+		hint(t);
+		return true;
+	}
+	unsigned value() const {
+		score v = 0;
+		for (unsigned i = 0; i < 16; i++) v += board::itov(operator()(i));
+		return v;
+	}
+
+public:
+	bool operator ==(const bitboard& b) const { return tile == b.tile; }
+	bool operator < (const bitboard& b) const { return tile <  b.tile; }
+	bool operator !=(const bitboard& b) const { return !(*this == b); }
+	bool operator > (const bitboard& b) const { return b < *this; }
+	bool operator <=(const bitboard& b) const { return !(b < *this); }
+	bool operator >=(const bitboard& b) const { return !(*this < b); }
+
+public:
+
+	/**
+	 * place a tile (index value) to the specific position (1-d index)
+	 * return >= 0 if the action is valid, or -1 if not
+	 */
+	reward place(unsigned pos, cell tile, cell hint_tile) {
+		data bak = info();
+		if (pos >= 16 || operator()(pos)) return -1;
+		if (hint() == 0 && !extract_hint_from_bag(tile)) return -1;
+		if (hint() != tile) return info(bak), -1;
+		if (!extract_hint_from_bag(hint_tile)) return info(bak), -1;
+		operator()(pos) = tile;
+		last(4);
+		return board::itov(tile);
+	}
+
+	/**
+	 * apply an action to the board
+	 * return the reward of the action, or -1 if the action is illegal
+	 */
+	reward slide(unsigned opcode) {
+		reward r = -1;
+		switch (opcode & 0b11) {
+		case 0: r = slide_up(); break;
+		case 1: r = slide_right(); break;
+		case 2: r = slide_down(); break;
+		case 3: r = slide_left(); break;
+		}
+		if (r != -1) last(opcode & 0b11);
+		return r;
+	}
+
+	reward slide_left() {
+		return slide_horizontal(&lookup::left, &lookup::left_score);
+	}
+	reward slide_right() {
+		return slide_horizontal(&lookup::right, &lookup::right_score);
+	}
+	reward slide_up() {
+		transpose();
+		reward score = slide_left();
+		transpose();
+		return score;
+	}
+	reward slide_down() {
+		transpose();
+		reward score = slide_right();
+		transpose();
+		return score;
+	}
+
+	void rotate(int clockwise_count = 1) {
+		switch (((clockwise_count % 4) + 4) % 4) {
+		default:
+		case 0: break;
+		case 1: rotate_clockwise(); break;
+		case 2: reverse(); break;
+		case 3: rotate_counterclockwise(); break;
+		}
+	}
+
+	void rotate_clockwise() { transpose(); reflect_horizontal(); }
+	void rotate_counterclockwise() { transpose(); reflect_vertical(); }
+	void reverse() { reflect_horizontal(); reflect_vertical(); }
+
+	void reflect_horizontal() {
+		tile = ((tile & 0x000f000f000f000full) << 12) | ((tile & 0x00f000f000f000f0ull) << 4)
+		     | ((tile & 0x0f000f000f000f00ull) >> 4) | ((tile & 0xf000f000f000f000ull) >> 12);
+	}
+
+	void reflect_vertical() {
+		tile = (tile << 48) | ((tile & 0x00000000ffff0000ull) << 16)
+		     | ((tile >> 16) & 0x00000000ffff0000ull) | (tile >> 48);
+	}
+
+	void transpose() {
+		grid t;
+		t = (tile ^ (tile >> 12)) & 0x0000f0f00000f0f0ull; tile ^= t ^ (t << 12); // swap within 2x2 blocks
+		t = (tile ^ (tile >> 24)) & 0x00000000ff00ff00ull; tile ^= t ^ (t << 24); // swap 2x2 blocks
+	}
+
+protected:
+	/**
+	 * precomputed result of sliding a single row in both horizontal directions
+	 */
+	struct lookup {
+		row left, right;
+		reward left_score, right_score;
+	};
+
+	/**
+	 * slide every row by the lookup table, i.e., four table lookups per move
+	 * return the total reward, or -1 if no row is changed
+	 */
+	reward slide_horizontal(row lookup::* dst, reward lookup::* score) {
+		grid moved = 0;
+		reward total = 0;
+		for (unsigned r = 0; r < 4; r++) {
+			const lookup& entry = find(operator[](r));
+			moved |= grid((entry.*dst) ^ operator[](r)) << (r << 4);
+			total += entry.*score;
+		}
+		tile ^= moved;
+		return (moved) ? total : -1;
+	}
+
+	static const lookup& find(row r) { return table()[r]; }
+	static std::array<lookup, 65536>& table() { static std::array<lookup, 65536> t; return t; }
+
+	/**
+	 * slide a single row toward its lowest nibble, following the rules of board::slide_left
+	 * the reward of merges is accumulated into score
+	 */
+	static row slide_row_left(row src, reward& score) {
+		cell t[4];
+		for (unsigned c = 0; c < 4; c++) t[c] = (src >> (c << 2)) & 0x0f;
+		for (unsigned c = 1; c < 4; c++) {
+			cell& t0 = t[c - 1];
+			cell& t1 = t[c];
+			if (t0 == 0) {
+				t0 = t1;
+				t1 = 0;
+			} else if (t1 != 0 && ((t0 + t1 == 3) || (t0 == t1 && t0 >= 3 && t0 < 14))) {
+				t0 = std::max(t0, t1) + 1;
+				t1 = 0;
+				score += board::itov(t0) - board::itov(t0 - 1) * 2;
+			}
+		}
+		return row(t[0] | (t[1] << 4) | (t[2] << 8) | (t[3] << 12));
+	}
+	static row reverse_row(row r) {
+		return row(((r & 0x000f) << 12) | ((r & 0x00f0) << 4) | ((r & 0x0f00) >> 4) | ((r & 0xf000) >> 12));
+	}
+	static __attribute__((constructor)) void init_lookup() {
+		std::array<lookup, 65536>& t = table();
+		for (unsigned r = 0; r < 65536; r++) {
+			lookup& entry = t[r];
+			entry.left_score = entry.right_score = 0;
+			entry.left = slide_row_left(r, entry.left_score);
+			entry.right = reverse_row(slide_row_left(reverse_row(r), entry.right_score));
+		}
+	}
+
+public:
+	friend std::ostream& operator <<(std::ostream& out, const bitboard& b) {
+		return out << board(b);
+	}
+	friend std::istream& operator >>(std::istream& in, bitboard& b) {
+		board tmp({}, b.info());
+		in >> tmp;
+		b = bitboard(tmp);
+		return in;
+	}
+
+private:
+	grid tile;
+	data attr; // same layout as board::attr
+};
@@ -0,0 +1,129 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * cache.h: Lock-free hash table of afterstate values
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <atomic>
+#include <memory>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <cstdlib>
+#include <new>
+#include "bitboard.h"
+
+/**
+ * fixed-size hash table of afterstate values, shared by all threads without locking
+ *
+ * the table consists of 64-byte buckets (one cache line), each with 4 slots of (check, data),
+ * where data is (generation:32-bit) (value:32-bit float), and check is (key ^ data)
+ * a slot is valid only if (check ^ data) matches the key, so that a torn write by another thread
+ * is detected as a miss rather than returning a wrong value (lockless hashing)
+ *
+ * the key is the packed board plus its hint/bag info, and all values are invalidated at once
+ * by advancing the generation, e.g., when the weights are updated
+ */
+class afterstate_cache {
+public:
+	afterstate_cache(unsigned bits) : bits(bits), generation(1), hits(0), lookups(0), table(allocate(bits)) {}
+
+	bool find(const bitboard& b, float& value) const {
+		uint64_t key = hash(b);
+		const bucket& bk = table.get()[key >> (64 - bits)];
+		uint32_t gen = generation.load(std::memory_order_relaxed);
+		for (const slot& s : bk.slots) {
+			uint64_t data = s.data.load(std::memory_order_relaxed);
+			uint64_t check = s.check.load(std::memory_order_relaxed);
+			if ((check ^ data) != key || uint32_t(data >> 32) != gen) continue;
+			uint32_t word = uint32_t(data);
+			std::memcpy(&value, &word, sizeof(value));
+			return true;
+		}
+		return false;
+	}
+
+	void store(const bitboard& b, float value) {
+		uint64_t key = hash(b);
+		bucket& bk = table.get()[key >> (64 - bits)];
+		uint32_t gen = generation.load(std::memory_order_relaxed);
+		uint32_t word;
+		std::memcpy(&word, &value, sizeof(value));
+		uint64_t data = (uint64_t(gen) << 32) | word;
+		slot* victim = &bk.slots[key & 3]; // replace a stale slot if any, otherwise a fixed slot of the key
+		for (slot& s : bk.slots) {
+			uint64_t old = s.data.load(std::memory_order_relaxed);
+			if (uint32_t(old >> 32) != gen) { victim = &s; break; }
+		}
+		victim->data.store(data, std::memory_order_relaxed);
+		victim->check.store(key ^ data, std::memory_order_relaxed);
+	}
+
+	/**
+	 * invalidate all cached values
+	 */
+	void invalidate() {
+		generation.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/**
+	 * accumulate the hit counters, which are kept locally by each user and flushed occasionally
+	 */
+	void record(size_t hit, size_t lookup) {
+		hits.fetch_add(hit, std::memory_order_relaxed);
+		lookups.fetch_add(lookup, std::memory_order_relaxed);
+	}
+
+	/**
+	 * report the hit rate since the last report, e.g., "cache: hit = 35.1% (351/1000)"
+	 */
+	std::string report() {
+		size_t hit = hits.exchange(0), lookup = lookups.exchange(0);
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(1);
+		ss << "cache: hit = " << (lookup ? hit * 100.0 / lookup : 0.0) << "% (" << hit << "/" << lookup << ")";
+		return ss.str();
+	}
+
+protected:
+	struct slot {
+		std::atomic<uint64_t> check;
+		std::atomic<uint64_t> data;
+	};
+	struct alignas(64) bucket {
+		slot slots[4];
+	};
+
+	static uint64_t hash(const bitboard& b) {
+		uint64_t x = b.raw() ^ ((b.info() & 0xfff0full) * 0x9e3779b97f4a7c15ull); // hint and bag, but not last
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+		return x ^ (x >> 31);
+	}
+
+	static std::shared_ptr<bucket> allocate(unsigned bits) {
+		size_t size = size_t(1) << bits;
+		void* addr = nullptr;
+		if (posix_memalign(&addr, sizeof(bucket), sizeof(bucket) * size) != 0) throw std::bad_alloc();
+		bucket* buckets = static_cast<bucket*>(addr);
+		for (size_t i = 0; i < size; i++) {
+			for (slot& s : (new (buckets + i) bucket)->slots) {
+				s.check.store(0, std::memory_order_relaxed);
+				s.data.store(0, std::memory_order_relaxed);
+			}
+		}
+		return std::shared_ptr<bucket>(buckets, [](bucket* p) { std::free(p); });
+	}
+
+private:
+	unsigned bits;
+	std::atomic<uint32_t> generation;
+	std::atomic<size_t> hits;
+	std::atomic<size_t> lookups;
+	std::shared_ptr<bucket> table;
+};
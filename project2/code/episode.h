@@ -15,7 +15,10 @@
 #include <sstream>
 #include <chrono>
 #include <numeric>
+#include <string>
+#include <cstring>
 #include "board.h"
+#include "bitboard.h"
 #include "action.h"
 #include "agent.h"
 
@@ -119,7 +122,61 @@ public:
 		return in;
 	}
 
+	/**
+	 * binary format of an episode, all fields are in native byte order:
+	 * the open meta, the final state (tiles:uint64_t, info:uint64_t), the score (uint64_t),
+	 * the number of moves (uint32_t) and their length in bytes (uint32_t) followed by the moves, and the close meta
+	 *
+	 * a meta is (length:uint16_t, tag, when:int64_t), and a move is of variable length, see move::write
+	 * the final state and score are kept so that loading does not need to replay the moves
+	 */
+	std::ostream& write(std::ostream& out) const {
+		std::string buf;
+		buf.reserve(64 + ep_moves.size() * move::typical_size);
+		ep_open.write(buf);
+		bitboard last(ep_state);
+		put(buf, uint64_t(last.raw()));
+		put(buf, uint64_t(last.info()));
+		put(buf, uint64_t(ep_score));
+		put(buf, uint32_t(ep_moves.size()));
+		size_t length = buf.size();
+		put(buf, uint32_t(0));
+		for (const move& mv : ep_moves) mv.write(buf);
+		uint32_t bytes = uint32_t(buf.size() - length - sizeof(uint32_t));
+		std::memcpy(&buf[length], &bytes, sizeof(bytes));
+		ep_close.write(buf);
+		return out.write(buf.data(), buf.size());
+	}
+	std::istream& read(std::istream& in) {
+		*this = {};
+		uint64_t raw, info, score;
+		uint32_t size, bytes;
+		if (!ep_open.read(in) || !get(in, raw) || !get(in, info) || !get(in, score) || !get(in, size) || !get(in, bytes)) return in;
+		ep_state = bitboard(raw, info);
+		ep_score = score;
+		std::string buf(bytes, '\0');
+		if (bytes && !in.read(&buf[0], buf.size())) return in;
+		ep_moves.resize(size);
+		const char* ptr = buf.data();
+		const char* end = buf.data() + buf.size();
+		for (move& mv : ep_moves) {
+			if (!mv.read(ptr, end)) {
+				in.setstate(std::ios::failbit);
+				return in;
+			}
+		}
+		if (ptr != end) in.setstate(std::ios::failbit);
+		else ep_close.read(in);
+		return in;
+	}
+
 protected:
+	template<typename type> static void put(std::string& buf, type v) {
+		buf.append(reinterpret_cast<const char*>(&v), sizeof(type));
+	}
+	template<typename type> static bool get(std::istream& in, type& v) {
+		return bool(in.read(reinterpret_cast<char*>(&v), sizeof(type)));
+	}
 
 	struct move {
 		action code;
@@ -134,6 +191,72 @@ protected:
 			if (m.time) out << '(' << std::dec << m.time << ')';
 			return out;
 		}
+
+		/**
+		 * a move is the 16-bit code (type:2-bit, has reward:1-bit, has time:1-bit, event:12-bit), where type 1 is place,
+		 * type 2 is slide, and type 3 is an invalid action, followed by the reward (int16_t) and the time (uint16_t)
+		 * only if they are nonzero; a reward or time that does not fit is escaped by INT16_MIN or UINT16_MAX and
+		 * followed by its full value (int32_t or uint32_t)
+		 * e.g., a placement takes 2 bytes and a slide that merges tiles takes 4 bytes
+		 */
+		static constexpr size_t typical_size = sizeof(uint16_t) * 2;
+		void write(std::string& buf) const {
+			uint16_t op = 0xc000;
+			if (code.type() == action::place::type) op = 0x4000 | (code.event() & 0x0fff);
+			if (code.type() == action::slide::type) op = 0x8000 | (code.event() & 0x0fff);
+			if (reward) op |= 0x2000;
+			if (time) op |= 0x1000;
+			put(buf, op);
+			if (reward) {
+				if (reward > INT16_MIN && reward <= INT16_MAX) {
+					put(buf, int16_t(reward));
+				} else {
+					put(buf, int16_t(INT16_MIN));
+					put(buf, int32_t(reward));
+				}
+			}
+			if (time) {
+				if (time < UINT16_MAX) {
+					put(buf, uint16_t(time));
+				} else {
+					put(buf, uint16_t(UINT16_MAX));
+					put(buf, uint32_t(time));
+				}
+			}
+		}
+		bool read(const char*& ptr, const char* end) {
+			auto fetch = [&](void* v, size_t n) -> bool {
+				if (size_t(end - ptr) < n) return false;
+				std::memcpy(v, ptr, n);
+				ptr += n;
+				return true;
+			};
+			uint16_t op;
+			if (!fetch(&op, sizeof(op))) return false;
+			switch (op >> 14) {
+			case 1: code = action(action::place::type | (op & 0x0fff)); break;
+			case 2: code = action(action::slide::type | (op & 0x0fff)); break;
+			default: code = action(); break;
+			}
+			reward = 0;
+			time = 0;
+			if (op & 0x2000) {
+				int16_t r;
+				int32_t full;
+				if (!fetch(&r, sizeof(r))) return false;
+				if (r == INT16_MIN && !fetch(&full, sizeof(full))) return false;
+				reward = (r == INT16_MIN) ? full : r;
+			}
+			if (op & 0x1000) {
+				uint16_t t;
+				uint32_t full;
+				if (!fetch(&t, sizeof(t))) return false;
+				if (t == UINT16_MAX && !fetch(&full, sizeof(full))) return false;
+				time = (t == UINT16_MAX) ? full : t;
+			}
+			return true;
+		}
+
 		friend std::istream& operator >>(std::istream& in, move& m) {
 			in >> m.code;
 			m.reward = 0;
@@ -163,6 +286,21 @@ protected:
 		friend std::istream& operator >>(std::istream& in, meta& m) {
 			return std::getline(in, m.tag, '@') >> std::dec >> m.when;
 		}
+
+		void write(std::string& buf) const {
+			put(buf, uint16_t(tag.size()));
+			buf.append(tag);
+			put(buf, int64_t(when));
+		}
+		std::istream& read(std::istream& in) {
+			uint16_t size;
+			int64_t time;
+			if (!get(in, size)) return in;
+			tag.assign(size, '\0');
+			if (size && !in.read(&tag[0], size)) return in;
+			if (get(in, time)) when = time;
+			return in;
+		}
 	};
 
 	static board initial_state() {
@@ -1,12 +1,22 @@
 #!/bin/bash
-
+# select the best checkpoint (weights.<episodes>.bin, or weights.bin in a tarball) by the average score of the last 1000 training episodes
+# recorded in its header, or by the judge if "judge" is given as the first argument (which extracts every tarball)
 
 best=0
 filename=""
-ls | grep .tar.gz | while read -r line; do
-    tar -xvzf $line
-    cp ./stats.txt ../judge/
-    score=`../judge/threes-judge --load=stats.txt --judge="version=2" | grep Assessment | cut -d ' ' -f 2`
+while read -r line; do
+    if [[ $line == *.bin ]]; then
+        [ "$1" == "judge" ] && continue
+        score=`head -c 4096 $line | grep -a '^average=' | cut -d '=' -f 2`
+        score=${score:-0}
+    elif [ "$1" == "judge" ]; then
+        tar -xvzf $line
+        cp ./stats.txt ../judge/
+        score=`../judge/threes-judge --load=stats.txt --judge="version=2" | grep Assessment | cut -d ' ' -f 2`
+    else
+        score=`tar -xzOf $line weights.bin 2>/dev/null | head -c 4096 | grep -a '^average=' | cut -d '=' -f 2`
+        score=${score:-0}
+    fi
     if (( $(echo "$score > $best" | bc -l) )); then
         best=$score
         filename=$line
@@ -17,7 +27,7 @@ ls | grep .tar.gz | while read -r line; do
     echo "---"
     echo $best
     echo $filename
-done
+done < <(ls | grep -E '\.tar\.gz$|^weights\.[0-9]+\.bin$')
 
 echo $best
 
@@ -0,0 +1,92 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * ntuple.h: Compile-time n-tuple patterns and their isomorphisms
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "bitboard.h"
+
+/**
+ * n-tuple pattern given by template parameters, e.g., ntuple<0, 1, 2, 4, 5, 6>
+ * the cells of all 8 isomorphisms are constant expressions, so that the extraction of each feature
+ * is fully unrolled into constant shifts of the packed board
+ *
+ * isomorphism (r) follows the order used by iso_weight_agent, i.e., r clockwise rotations for r < 4,
+ * and r - 4 clockwise rotations of the vertically reflected board for r >= 4
+ * the first cell of the tuple is the highest nibble of the feature
+ */
+template<unsigned... cells>
+struct ntuple {
+	static constexpr size_t size = sizeof...(cells);
+
+	/**
+	 * the original position of the cell at position p, after isomorphism r is applied to the board
+	 */
+	static constexpr unsigned isomorphic(unsigned p, unsigned r) {
+		return r < 4 ? rotate(p, r) : flip(rotate(p, r - 4));
+	}
+	static constexpr unsigned rotate(unsigned p, unsigned n) {
+		return n == 0 ? p : rotate((3 - p % 4) * 4 + p / 4, n - 1);
+	}
+	static constexpr unsigned flip(unsigned p) {
+		return (3 - p / 4) * 4 + p % 4;
+	}
+
+	template<unsigned r>
+	static uint32_t feature(bitboard::grid raw) {
+		const unsigned shift[] = { isomorphic(cells, r) * 4 ... };
+		uint32_t f = 0;
+		for (size_t k = 0; k < size; k++) f = (f << 4) | ((raw >> shift[k]) & 0x0f);
+		return f;
+	}
+
+	/**
+	 * the features of all 8 isomorphisms
+	 */
+	static void extract(bitboard::grid raw, uint32_t* index) {
+		index[0] = feature<0>(raw);
+		index[1] = feature<1>(raw);
+		index[2] = feature<2>(raw);
+		index[3] = feature<3>(raw);
+		index[4] = feature<4>(raw);
+		index[5] = feature<5>(raw);
+		index[6] = feature<6>(raw);
+		index[7] = feature<7>(raw);
+	}
+
+	static std::vector<int> pattern() { return { int(cells)... }; }
+};
+
+/**
+ * n-tuple network of compile-time patterns, e.g., ntuple_network<ntuple<0, 1, 2, 3>, ntuple<4, 5, 6, 7>>
+ * the features of tuple t are stored at index[8t] to index[8t + 7]
+ */
+template<typename... tuples>
+struct ntuple_network;
+
+template<>
+struct ntuple_network<> {
+	static constexpr size_t size = 0;
+	static void extract(bitboard::grid raw, uint32_t* index) {}
+	static std::vector<std::vector<int>> patterns() { return {}; }
+};
+
+template<typename tuple, typename... rest>
+struct ntuple_network<tuple, rest...> {
+	static constexpr size_t size = 1 + sizeof...(rest);
+	static void extract(bitboard::grid raw, uint32_t* index) {
+		tuple::extract(raw, index);
+		ntuple_network<rest...>::extract(raw, index + 8);
+	}
+	static std::vector<std::vector<int>> patterns() {
+		std::vector<std::vector<int>> p = ntuple_network<rest...>::patterns();
+		p.insert(p.begin(), tuple::pattern());
+		return p;
+	}
+};
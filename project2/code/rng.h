@@ -0,0 +1,183 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * rng.h: Define the pseudo-random number generators of agents
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <initializer_list>
+#include <iostream>
+#include <cstdlib>
+
+/**
+ * SplitMix64, used to expand seeds into generator states
+ */
+inline uint64_t splitmix64(uint64_t& x) {
+	uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+/**
+ * xoshiro256** by Blackman and Vigna, 256-bit state and 64-bit output
+ */
+class xoshiro256ss {
+public:
+	typedef uint64_t result_type;
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return ~result_type(0); }
+
+	xoshiro256ss(uint64_t key = 0) { seed(key); }
+	void seed(uint64_t key) {
+		for (uint64_t& x : s) x = splitmix64(key);
+	}
+
+	result_type operator()() {
+		uint64_t result = rotl(s[1] * 5, 7) * 9;
+		uint64_t t = s[1] << 17;
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = rotl(s[3], 45);
+		return result;
+	}
+
+private:
+	static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+	uint64_t s[4];
+};
+
+/**
+ * PCG32 (XSH-RR) by O'Neill, 64-bit state and 32-bit output
+ */
+class pcg32 {
+public:
+	typedef uint32_t result_type;
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return ~result_type(0); }
+
+	pcg32(uint64_t key = 0) { seed(key); }
+	void seed(uint64_t key) {
+		uint64_t init = splitmix64(key);
+		inc = (splitmix64(key) << 1) | 1; // the stream is selected by the odd increment
+		state = 0;
+		operator()();
+		state += init;
+		operator()();
+	}
+
+	result_type operator()() {
+		uint64_t old = state;
+		state = old * 6364136223846793005ull + inc;
+		uint32_t xorshifted = uint32_t(((old >> 18) ^ old) >> 27);
+		uint32_t rot = uint32_t(old >> 59);
+		return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+	}
+
+private:
+	uint64_t state, inc;
+};
+
+/**
+ * the generator of an agent, selected by rng=xoshiro (default), rng=pcg, or rng=std
+ * rng=std is the former std::default_random_engine with std::shuffle, which reproduces the former results
+ *
+ * a generator is seeded by a list of keys, e.g., { seed, stream, episode }, so that each combination
+ * has its own independent sequence regardless of what other generators have consumed
+ */
+class rng {
+public:
+	enum kind { xoshiro, pcg, legacy };
+
+	rng(const std::string& name = "xoshiro") : type(parse(name)) {
+		if (type != legacy) seed({ 0 });
+	}
+
+	kind generator() const { return type; }
+
+	void seed(std::initializer_list<uint64_t> keys) {
+		if (type == legacy) {
+			if (keys.size() == 1) {
+				engine.seed(*keys.begin());
+			} else {
+				std::vector<uint32_t> words(keys.begin(), keys.end());
+				std::seed_seq seq(words.begin(), words.end());
+				engine.seed(seq);
+			}
+			return;
+		}
+		uint64_t key = 0;
+		for (uint64_t k : keys) {
+			key ^= k;
+			key = splitmix64(key);
+		}
+		fast64.seed(key);
+		fast32.seed(key);
+	}
+
+	/**
+	 * a uniform integer in [0, n), by Lemire's multiply-and-reject method without modulo bias
+	 */
+	uint32_t below(uint32_t n) {
+		switch (type) {
+		case xoshiro: return bounded(fast64, n);
+		case pcg:     return bounded(fast32, n);
+		default:      return std::uniform_int_distribution<uint32_t>(0, n - 1)(engine);
+		}
+	}
+
+	/**
+	 * shuffle a range uniformly (Fisher-Yates)
+	 */
+	template<typename iterator>
+	void shuffle(iterator first, iterator last) {
+		switch (type) {
+		case xoshiro: return fisher_yates(first, last, fast64);
+		case pcg:     return fisher_yates(first, last, fast32);
+		default:      return std::shuffle(first, last, engine);
+		}
+	}
+
+private:
+	template<typename generator>
+	static uint32_t bounded(generator& g, uint32_t n) {
+		auto bits = [&]() { return uint32_t(g() >> (sizeof(typename generator::result_type) * 8 - 32)); };
+		uint64_t m = uint64_t(bits()) * n;
+		if (uint32_t(m) < n) {
+			uint32_t threshold = uint32_t(-n) % n;
+			while (uint32_t(m) < threshold) m = uint64_t(bits()) * n;
+		}
+		return uint32_t(m >> 32);
+	}
+
+	template<typename iterator, typename generator>
+	static void fisher_yates(iterator first, iterator last, generator& g) {
+		for (auto i = last - first; i > 1; i--)
+			std::iter_swap(first + (i - 1), first + bounded(g, uint32_t(i)));
+	}
+
+	static kind parse(const std::string& name) {
+		if (name == "xoshiro" || name == "xoshiro256**") return xoshiro;
+		if (name == "pcg" || name == "pcg32") return pcg;
+		if (name == "std" || name == "minstd") return legacy;
+		std::cerr << "unknown rng: " << name << std::endl;
+		std::exit(-1);
+	}
+
+private:
+	kind type;
+	xoshiro256ss fast64;
+	pcg32 fast32;
+	std::default_random_engine engine;
+};
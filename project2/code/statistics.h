@@ -12,6 +12,10 @@
 #include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <vector>
+#include <string>
+#include <functional>
+#include <cstdlib>
 #include "board.h"
 #include "action.h"
 #include "episode.h"
@@ -34,6 +38,7 @@ public:
 public:
 	/**
 	 * show the statistics of last 'block' games
+	 * in the streaming mode, the statistics since the last show (or of all games if blk is set) are shown
 	 *
 	 * the format is
 	 * 1000    avg = 282, max = 2325, ops = 1346086 (2840867|955796)
@@ -54,24 +59,18 @@ public:
 	 * '45.3%': 45.3% of the games terminated with 24-tiles as the largest tile
 	 */
 	void show(bool tstat = true, size_t blk = 0) const {
-		size_t num = std::min(data.size(), blk ?: block);
-		size_t stat[64] = { 0 };
-		size_t sop = 0, pop = 0, eop = 0;
-		time_t sdu = 0, pdu = 0, edu = 0;
-		board::score sum = 0, max = 0;
-		auto it = data.end();
-		for (size_t i = 0; i < num; i++) {
-			auto& ep = *(--it);
-			sum += ep.score();
-			max = std::max(ep.score(), max);
-			stat[*std::max_element(ep.state().begin(), ep.state().end())]++;
-			sop += ep.step();
-			pop += ep.step(action::slide::type);
-			eop += ep.step(action::place::type);
-			sdu += ep.time();
-			pdu += ep.time(action::slide::type);
-			edu += ep.time(action::place::type);
+		accumulator acc;
+		if (!sink) {
+			size_t num = std::min(data.size(), blk ?: block);
+			for (auto it = data.end(); acc.num < num; acc.add(*(--it)));
+		} else {
+			acc = blk ? overall : recent;
 		}
+		size_t num = acc.num;
+		const size_t* stat = acc.stat;
+		board::score sum = acc.sum, max = acc.max;
+		size_t sop = acc.sop, pop = acc.pop, eop = acc.eop;
+		time_t sdu = acc.sdu, pdu = acc.pdu, edu = acc.edu;
 
 		std::ios ff(nullptr);
 		ff.copyfmt(std::cout);
@@ -84,11 +83,15 @@ public:
 		std::cout <<      "|" << (eop * 1000.0 / edu) << ")";
 		std::cout << std::endl;
 		std::cout.copyfmt(ff);
+		for (auto& report : reports) {
+			std::string line = report();
+			if (line.size()) std::cout << "\t" << line << std::endl;
+		}
 
 		if (!tstat) return;
 		for (size_t t = 0, c = 0; c < num; c += stat[t++]) {
 			if (stat[t] == 0) continue;
-			size_t accu = std::accumulate(std::begin(stat) + t, std::end(stat), size_t(0));
+			size_t accu = std::accumulate(stat + t, stat + 64, size_t(0));
 			std::cout << "\t" << board::itot(t); // type
 			std::cout << "\t" << (accu * 100.0 / num) << "%"; // win rate
 			std::cout << "\t" "(" << (stat[t] * 100.0 / num) << "%" ")"; // percentage of ending
@@ -97,8 +100,30 @@ public:
 		std::cout << std::endl;
 	}
 
+	/**
+	 * register an extra report to be shown with the statistics, e.g., the hit rate of a cache
+	 * the report is called once per show, and an empty report is omitted
+	 */
+	void watch(std::function<std::string()> report) {
+		reports.push_back(report);
+	}
+
 	void summary() const {
-		show(true, data.size());
+		show(true, sink ? count : data.size());
+	}
+
+	/**
+	 * switch to the streaming mode, in which only the running accumulators are kept,
+	 * and each episode is written to the stream (or dropped if the stream is null) once it is closed
+	 * the episodes are written in the text format, or in the binary format if binary is set
+	 */
+	void stream(std::ostream* to, bool binary = false) {
+		static std::ostream null(nullptr);
+		sink = to ? to : &null;
+		raw = binary;
+		if (to && binary) to->write(magic(), 8);
+		for (const episode& rec : data) flush(rec);
+		data.clear();
 	}
 
 	bool is_finished() const {
@@ -106,14 +131,26 @@ public:
 	}
 
 	void open_episode(const std::string& flag = "") {
-		if (count++ >= limit) data.pop_front();
+		if (count++ >= limit && !sink) data.pop_front();
 		data.emplace_back();
 		data.back().open_episode(flag);
 	}
 
 	void close_episode(const std::string& flag = "") {
 		data.back().close_episode(flag);
-		if (count % block == 0) show();
+		if (sink) flush(data.back()), data.pop_back();
+		if (count % block == 0) show(), recent = {};
+	}
+
+	/**
+	 * record an episode which is played outside of the statistics, e.g., by a parallel worker
+	 * the episode should be already closed
+	 */
+	void push_episode(episode&& ep) {
+		if (count++ >= limit && !sink) data.pop_front();
+		if (sink) flush(ep);
+		else data.push_back(std::move(ep));
+		if (count % block == 0) show(), recent = {};
 	}
 
 	episode& at(size_t i) {
@@ -143,10 +180,71 @@ public:
 		return in;
 	}
 
+	/**
+	 * binary format of the records, i.e., magic (8 bytes) followed by episode::write of each episode
+	 * the format converts losslessly to and from the text format
+	 */
+	static constexpr const char* magic() { return "THREESE2"; }
+
+	std::ostream& write(std::ostream& out) const {
+		out.write(magic(), 8);
+		for (const episode& rec : data) rec.write(out);
+		return out;
+	}
+	std::istream& read(std::istream& in) {
+		char head[8] = {};
+		if (!in.read(head, 8) || std::string(head, 8) != magic()) {
+			std::cerr << "unknown format of binary statistics, expected " << magic() << std::endl;
+			std::exit(-1);
+		}
+		for (episode rec; rec.read(in); ) data.push_back(std::move(rec));
+		total = std::max(total, data.size());
+		count = data.size();
+		return in;
+	}
+
+private:
+	/**
+	 * running sums of the statistics shown by show
+	 */
+	struct accumulator {
+		size_t num = 0;
+		size_t stat[64] = { 0 };
+		size_t sop = 0, pop = 0, eop = 0;
+		time_t sdu = 0, pdu = 0, edu = 0;
+		board::score sum = 0, max = 0;
+
+		void add(const episode& ep) {
+			num++;
+			sum += ep.score();
+			max = std::max(ep.score(), max);
+			stat[*std::max_element(ep.state().begin(), ep.state().end())]++;
+			sop += ep.step();
+			pop += ep.step(action::slide::type);
+			eop += ep.step(action::place::type);
+			sdu += ep.time();
+			pdu += ep.time(action::slide::type);
+			edu += ep.time(action::place::type);
+		}
+	};
+
+	void flush(const episode& ep) {
+		recent.add(ep);
+		overall.add(ep);
+		if (raw) ep.write(*sink);
+		else *sink << ep << std::endl;
+	}
+
 private:
 	size_t total;
 	size_t block;
 	size_t limit;
 	size_t count;
 	std::deque<episode> data;
+	std::vector<std::function<std::string()>> reports;
+
+	std::ostream* sink = nullptr; // the sink of the streaming mode, or null if not streaming
+	bool raw = false;
+	accumulator recent;
+	accumulator overall;
 };
@@ -0,0 +1,80 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * test.cpp: Consistency checks of the placer model
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <set>
+#include <tuple>
+#include <cmath>
+#include "board.h"
+#include "bitboard.h"
+#include "action.h"
+#include "agent.h"
+
+int main(int argc, const char* argv[]) {
+	size_t positions = 2000, samples = 64, failed = 0;
+
+	// afterstates from games of a seeded random slider and placer
+	std::vector<board> afters;
+	random_slider slider("seed=1");
+	random_placer placer("seed=2");
+	board b;
+	auto restart = [&]() { // a new game starts with 9 placements
+		b = board();
+		for (int i = 0; i < 9; i++) placer.take_action(b).apply(b);
+	};
+	for (restart(); afters.size() < positions; ) {
+		if (slider.take_action(b).apply(b) == -1) { restart(); continue; }
+		afters.push_back(b);
+		if (placer.take_action(b).apply(b) == -1) restart();
+	}
+
+	// including the states of every last slide, where the side may be full
+	for (size_t i = 0, n = afters.size(); i < n; i++) {
+		for (unsigned last = 0; last <= 4; last++) {
+			board variant(afters[i]);
+			variant.last(last);
+			afters.push_back(variant);
+		}
+	}
+
+	// every sampled placement must be one of the enumerated outcomes, whose probabilities sum to 1,
+	// and no placement is taken if there is no outcome
+	for (const board& after : afters) {
+		std::set<std::tuple<unsigned, unsigned, unsigned>> outcomes;
+		float sum = 0;
+		random_placer::enumerate(after, [&](unsigned pos, unsigned tile, unsigned hint, float prob) {
+			outcomes.emplace(pos, tile, hint);
+			sum += prob;
+		});
+		if (outcomes.size() && std::fabs(sum - 1) > 1e-4) {
+			std::cerr << after << "probabilities sum to " << sum << std::endl;
+			failed++;
+		}
+		for (size_t i = 0; i < samples; i++) {
+			action::place move(placer.take_action(after));
+			board next(after);
+			if (outcomes.empty()) {
+				if (move.action::type() != action::place::type) continue;
+				std::cerr << after << "placement " << move << " is taken on a full side" << std::endl;
+				failed++;
+				break;
+			}
+			if (!outcomes.count(std::make_tuple(move.position(), move.tile(), move.hint())) || move.apply(next) == -1) {
+				std::cerr << after << "placement " << move << " is not an enumerated outcome" << std::endl;
+				failed++;
+				break;
+			}
+		}
+	}
+
+	std::cout << "placer: " << afters.size() << " positions, " << failed << " failed" << std::endl;
+	return failed ? 1 : 0;
+}
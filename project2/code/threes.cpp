@@ -11,6 +11,12 @@
 #include <fstream>
 #include <iterator>
 #include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <sstream>
 #include "board.h"
 #include "action.h"
 #include "agent.h"
@@ -22,9 +28,10 @@ int main(int argc, const char* argv[]) {
 	std::copy(argv, argv + argc, std::ostream_iterator<const char*>(std::cout, " "));
 	std::cout << std::endl << std::endl;
 
-	size_t total = 1000, block = 0, limit = 0;
+	size_t total = 1000, block = 0, limit = 0, threads = 0;
 	std::string slide_args, place_args;
 	std::string load_path, save_path;
+	bool stream = false;
 	for (int i = 1; i < argc; i++) {
 		std::string arg = argv[i];
 		auto match_arg = [&](std::string flag) -> bool {
@@ -49,20 +56,119 @@ int main(int argc, const char* argv[]) {
 			load_path = next_opt();
 		} else if (match_arg("save")) {
 			save_path = next_opt();
+		} else if (match_arg("threads")) {
+			threads = std::stoull(next_opt());
+		} else if (match_arg("stream")) {
+			stream = true;
 		}
 	}
 
 	statistics stats(total, block, limit);
 
+	auto is_binary = [](const std::string& path) -> bool { // binary statistics are saved as *.bin
+		return path.size() >= 4 && path.compare(path.size() - 4, 4, ".bin") == 0;
+	};
+
 	if (load_path.size()) {
-		std::ifstream in(load_path, std::ios::in);
-		in >> stats;
+		std::ifstream in(load_path, std::ios::in | std::ios::binary);
+		if (is_binary(load_path)) stats.read(in);
+		else in >> stats;
 		in.close();
 		if (stats.is_finished()) stats.summary();
 	}
 
-	iso_weight_agent slide(slide_args);
-	random_placer place(place_args);
+	std::ofstream sink;
+	if (stream) { // keep constant memory, episodes are written to the save path (if any) once closed
+		if (save_path.size()) sink.open(save_path, std::ios::out | std::ios::binary | std::ios::trunc);
+		stats.stream(sink.is_open() ? &sink : nullptr, is_binary(save_path));
+	}
+
+	expectimax_slider slide(slide_args);
+	bool adversarial = (" " + place_args + " ").find(" search=adversarial ") != std::string::npos;
+	auto arg_of = [](const std::string& args, const std::string& key) -> std::string { // the value of key=, if any
+		std::stringstream ss(args);
+		std::string value;
+		for (std::string pair; ss >> pair; )
+			if (pair.compare(0, key.size() + 1, key + "=") == 0) value = pair.substr(key.size() + 1);
+		return value;
+	};
+	auto load_of = [&](const std::string& args) { return arg_of(args, "load"); };
+	std::unique_ptr<agent> placer;
+	if (adversarial && (load_of(place_args).empty() || load_of(place_args) == load_of(slide_args)))
+		placer.reset(new adversarial_placer(place_args, slide)); // attack the network of the slider on its own tables
+	else if (adversarial)
+		placer.reset(new adversarial_placer(place_args));
+	else
+		placer.reset(new random_placer(place_args));
+	agent& place = *placer;
+	auto fork_placer = [&](const std::string& args) -> std::unique_ptr<agent> { // a placer for a parallel worker or episode
+		if (adversarial) return std::unique_ptr<agent>(new adversarial_placer(static_cast<adversarial_placer&>(place)));
+		return std::unique_ptr<agent>(new random_placer(place_args + " " + args));
+	};
+	stats.watch([&]() { return slide.cache_report(); });
+
+	auto play = [](agent& slider, agent& placer) -> episode { // play an episode outside of the statistics
+		slider.open_episode("~:" + placer.name());
+		placer.open_episode(slider.name() + ":~");
+
+		episode game;
+		game.open_episode(slider.name() + ":" + placer.name());
+		while (true) {
+			agent& who = game.take_turns(slider, placer);
+			action move = who.take_action(game.state());
+			if (game.apply_action(move) != true) break;
+			if (who.check_for_win(game.state())) break;
+		}
+		agent& win = game.last_turns(slider, placer);
+		game.close_episode(win.name());
+
+		slider.close_episode(win.name());
+		placer.close_episode(win.name());
+		return game;
+	};
+
+	if (threads && !slide.is_learning() && (arg_of(place_args, "rng") == "std" || arg_of(place_args, "rng") == "minstd")) {
+		std::cerr << "rng=std draws a single sequence over all episodes, which cannot be split over threads" << std::endl;
+		return 1;
+	}
+	if (threads && !slide.is_learning()) { // launch deterministic evaluation, the results are the same for any number of threads
+		std::atomic<size_t> claimed(stats.step());
+		std::mutex lock;
+		std::map<size_t, episode> pending; // finished episodes waiting for their predecessors
+		size_t merged = stats.step();
+		auto work = [&](size_t id) {
+			expectimax_slider slide_worker(slide);
+			for (size_t index; (index = claimed++) < total; ) {
+				std::unique_ptr<agent> place_worker = fork_placer("episode=" + std::to_string(index)); // seeded by the episode index
+				episode game = play(slide_worker, *place_worker);
+
+				std::lock_guard<std::mutex> guard(lock);
+				pending.emplace(index, std::move(game));
+				for (auto it = pending.begin(); it != pending.end() && it->first == merged; it = pending.erase(it), merged++)
+					stats.push_episode(std::move(it->second));
+			}
+		};
+		std::vector<std::thread> workers;
+		for (size_t id = 0; id < threads; id++) workers.emplace_back(work, id);
+		for (std::thread& worker : workers) worker.join();
+
+	} else if (threads > 1) { // launch parallel self-play, all workers share the network of slide
+		std::atomic<size_t> claimed(stats.step());
+		std::mutex lock;
+		auto work = [&](size_t id) {
+			expectimax_slider slide_worker(slide);
+			std::unique_ptr<agent> place_worker = fork_placer("stream=" + std::to_string(id));
+			while (claimed++ < total) {
+				episode game = play(slide_worker, *place_worker);
+
+				std::lock_guard<std::mutex> guard(lock);
+				stats.push_episode(std::move(game));
+			}
+		};
+		std::vector<std::thread> workers;
+		for (size_t id = 0; id < threads; id++) workers.emplace_back(work, id);
+		for (std::thread& worker : workers) worker.join();
+	}
 
 	while (!stats.is_finished()) {
 //		std::cerr << "======== Game " << stats.step() << " ========" << std::endl;
@@ -85,9 +191,10 @@ int main(int argc, const char* argv[]) {
 		place.close_episode(win.name());
 	}
 
-	if (save_path.size()) {
-		std::ofstream out(save_path, std::ios::out | std::ios::trunc);
-		out << stats;
+	if (save_path.size() && !stream) {
+		std::ofstream out(save_path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (is_binary(save_path)) stats.write(out);
+		else out << stats;
 		out.close();
 	}
 
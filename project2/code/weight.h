@@ -9,41 +9,395 @@
 
 #pragma once
 #include <iostream>
+#include <fstream>
 #include <vector>
+#include <memory>
 #include <utility>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <map>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <array>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#endif
 
-class weight {
+/**
+ * page placement of weight tables, configured before the tables are allocated
+ * tables may be backed by 2 MB huge pages (explicit if reserved, transparent otherwise),
+ * and interleaved across all NUMA nodes, so that the threads of every node see the same average latency
+ * any placement unavailable on the system is skipped, i.e., the tables are still allocated with default pages
+ */
+class placement {
 public:
-	typedef float type;
+	static bool& huge_pages() { static bool huge = false; return huge; }
+	static bool& interleave() { static bool numa = false; return numa; }
+	static bool standard() { return !huge_pages() && !interleave(); }
+
+	/**
+	 * allocate zero-filled memory of the given size with the configured placement
+	 */
+	static std::shared_ptr<char> allocate(size_t size) {
+		const size_t page = 2 << 20;
+		size_t len = (std::max<size_t>(size, 1) + page - 1) / page * page;
+		void* addr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+		if (huge_pages())
+			addr = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+		if (addr == MAP_FAILED) { // map one more page and trim it, so that the region is aligned to 2 MB
+			addr = ::mmap(nullptr, len + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (addr == MAP_FAILED) throw std::bad_alloc();
+			char* base = static_cast<char*>(addr);
+			char* head = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(base) + page - 1) / page * page);
+			if (head != base) ::munmap(base, head - base);
+			::munmap(head + len, base + page - head);
+			addr = head;
+#ifdef MADV_HUGEPAGE
+			if (huge_pages()) ::madvise(addr, len, MADV_HUGEPAGE);
+#endif
+		}
+		if (interleave()) bind_interleave(addr, len);
+		return std::shared_ptr<char>(static_cast<char*>(addr), [len](char* p) { ::munmap(p, len); });
+	}
+
+protected:
+	/**
+	 * set the interleave policy (MPOL_INTERLEAVE) over the online nodes, before any page is touched
+	 */
+	static void bind_interleave(void* addr, size_t len) {
+#ifdef SYS_mbind
+		unsigned long nodes = online_nodes();
+		if (nodes & (nodes - 1)) // more than one node
+			::syscall(SYS_mbind, addr, len, 3 /* MPOL_INTERLEAVE */, &nodes, sizeof(nodes) * 8 + 1, 0);
+#endif
+	}
+
+	/**
+	 * the mask of online nodes, e.g., "0-1" for a dual-socket machine, or 1 (node 0 only) if unknown
+	 */
+	static unsigned long online_nodes() {
+		std::ifstream in("/sys/devices/system/node/online");
+		unsigned long nodes = 0;
+		for (std::string range; std::getline(in, range, ','); ) {
+			unsigned first = 0, last = 0;
+			int n = std::sscanf(range.c_str(), "%u-%u", &first, &last);
+			if (n < 1) continue;
+			if (n < 2) last = first;
+			for (unsigned i = first; i <= last && i < sizeof(nodes) * 8; i++) nodes |= 1ul << i;
+		}
+		return nodes ? nodes : 1;
+	}
+};
+
+/**
+ * CRC-32C (Castagnoli) checksum, by the SSE 4.2 instruction if the CPU supports it, or by a lookup table otherwise
+ * update() takes and returns the raw register, i.e., start from ~0 and invert the final value
+ */
+struct crc32c {
+	static uint32_t update(uint32_t crc, const void* data, size_t len) {
+#if defined(__x86_64__)
+		static const bool sse42 = __builtin_cpu_supports("sse4.2");
+		if (sse42) return update_sse42(crc, static_cast<const uint8_t*>(data), len);
+#endif
+		const std::array<uint32_t, 256>& t = table();
+		const uint8_t* p = static_cast<const uint8_t*>(data);
+		for (size_t i = 0; i < len; i++) crc = t[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+		return crc;
+	}
+
+protected:
+#if defined(__x86_64__)
+	__attribute__((target("sse4.2")))
+	static uint32_t update_sse42(uint32_t crc, const uint8_t* p, size_t len) {
+		uint64_t c = crc;
+		for (; len >= 8; p += 8, len -= 8) {
+			uint64_t word;
+			std::memcpy(&word, p, sizeof(word));
+			c = _mm_crc32_u64(c, word);
+		}
+		for (; len; p++, len--) c = _mm_crc32_u8(uint32_t(c), *p);
+		return uint32_t(c);
+	}
+#endif
+
+	static const std::array<uint32_t, 256>& table() {
+		static const std::array<uint32_t, 256> t = make_table();
+		return t;
+	}
+	static std::array<uint32_t, 256> make_table() {
+		std::array<uint32_t, 256> t;
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++) c = (c >> 1) ^ ((c & 1) ? 0x82f63b78u : 0);
+			t[i] = c;
+		}
+		return t;
+	}
+};
+
+/**
+ * half-precision (IEEE 754 binary16) number, for storing weights only
+ * values beyond the range are saturated, so that no infinity is produced
+ */
+struct half {
+	uint16_t bits;
+
+	half() = default;
+	half(float v) {
+		uint32_t x;
+		float a = std::fabs(v) * (1.0f / (1ull << 56) / (1ull << 56)); // rebias the exponent from 127 to 15
+		std::memcpy(&x, &a, sizeof(x));
+		x += 0x0fffu + ((x >> 13) & 1); // round to nearest even
+		bits = std::min<uint32_t>(x >> 13, 0x7bffu) | (std::signbit(v) ? 0x8000u : 0);
+	}
+	operator float() const {
+		uint32_t x = uint32_t(bits & 0x7fffu) << 13;
+		float a;
+		std::memcpy(&a, &x, sizeof(a));
+		a *= (1.0f * (1ull << 56) * (1ull << 56));
+		return (bits & 0x8000u) ? -a : a;
+	}
+};
+
+/**
+ * lookup table of an n-tuple network, of float (for training) or a compact storage type (for evaluation only),
+ * i.e., half for half precision, or int16_t for fixed-point numbers
+ * the table either owns its storage, or refers to a region of a memory-mapped weight file
+ */
+template<typename storage>
+class basic_weight {
+public:
+	typedef storage type;
 
 public:
-	weight() {}
-	weight(size_t len) : value(len) {}
-	weight(weight&& f) : value(std::move(f.value)) {}
-	weight(const weight& f) = default;
+	basic_weight() : table(nullptr), length(0) {}
+	basic_weight(size_t len) : value(allocate(len)), table(value.get()), length(len) {}
+	basic_weight(basic_weight&& f) : value(std::move(f.value)), table(f.table), length(f.length) { f.table = nullptr; f.length = 0; }
+	basic_weight(const basic_weight& f) : basic_weight(f.length) { std::copy(f.table, f.table + f.length, table); }
 
-	weight& operator =(const weight& f) = default;
-	type& operator[] (size_t i) { return value[i]; }
-	const type& operator[] (size_t i) const { return value[i]; }
-	size_t size() const { return value.size(); }
+	basic_weight& operator =(const basic_weight& f) { return operator =(basic_weight(f)); }
+	basic_weight& operator =(basic_weight&& f) { std::swap(value, f.value); std::swap(table, f.table); std::swap(length, f.length); return *this; }
+	type& operator[] (size_t i) { return table[i]; }
+	const type& operator[] (size_t i) const { return table[i]; }
+	size_t size() const { return length; }
+	type* data() { return table; }
+	const type* data() const { return table; }
 
 public:
-	friend std::ostream& operator <<(std::ostream& out, const weight& w) {
-		auto& value = w.value;
-		uint64_t size = value.size();
+	friend std::ostream& operator <<(std::ostream& out, const basic_weight& w) {
+		uint64_t size = w.size();
 		out.write(reinterpret_cast<const char*>(&size), sizeof(uint64_t));
-		out.write(reinterpret_cast<const char*>(value.data()), sizeof(type) * size);
+		out.write(reinterpret_cast<const char*>(w.data()), sizeof(type) * size);
 		return out;
 	}
-	friend std::istream& operator >>(std::istream& in, weight& w) {
-		auto& value = w.value;
+	friend std::istream& operator >>(std::istream& in, basic_weight& w) {
 		uint64_t size = 0;
 		in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
-		value.resize(size);
-		in.read(reinterpret_cast<char*>(value.data()), sizeof(type) * size);
+		w = basic_weight(size);
+		in.read(reinterpret_cast<char*>(w.data()), sizeof(type) * size);
 		return in;
 	}
 
+public:
+	/**
+	 * the mappable weight file format (version 2) is
+	 * magic (8 bytes), the length of the properties (uint64_t), the properties as "key=value" lines padded to 8 bytes,
+	 * the number of tables (uint64_t), and then (offset, size) of each table (uint64_t each),
+	 * where each table is stored at a page-aligned offset so that it can be used in place
+	 *
+	 * the properties describe the network (e.g., its tuple patterns) and the training progress, and always contain
+	 * the CRC-32C of all tables, so that the header can be inspected by tools, e.g., grep -a '^average=' weights.bin
+	 *
+	 * version 1 (the same without properties) and the legacy format, i.e., the number of tables (uint32_t)
+	 * followed by weight::operator<< of each table, are still accepted by load
+	 */
+	typedef std::map<std::string, std::string> properties;
+	static constexpr const char* magic() { return "NTUPLE\x02\x00"; }
+	static constexpr size_t alignment() { return 4096; }
+
+	/**
+	 * save the tables in the mappable format, along with the given properties
+	 * the file is written aside and then renamed, since the tables may be mapped from the same path
+	 * return false if the file cannot be written
+	 */
+	static bool save(const std::string& path, const std::vector<basic_weight>& net, properties info = {}) {
+		info["crc32c"] = checksum(net);
+		std::string text = "\n"; // so that each property starts a line, even after the binary fields
+		for (const auto& prop : info) text += prop.first + "=" + prop.second + "\n";
+		text.resize((text.size() + 7) / 8 * 8, '\n');
+
+		std::string temp = path + ".tmp";
+		std::ofstream out(temp, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!out.is_open()) return false;
+		uint64_t length = text.size();
+		std::vector<uint64_t> header = { net.size() };
+		uint64_t offset = 16 + length + sizeof(uint64_t) * (1 + 2 * net.size());
+		for (const basic_weight& w : net) {
+			offset = (offset + alignment() - 1) / alignment() * alignment();
+			header.push_back(offset);
+			header.push_back(w.size());
+			offset += sizeof(type) * w.size();
+		}
+		out.write(magic(), 8);
+		out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+		out.write(text.data(), text.size());
+		out.write(reinterpret_cast<const char*>(header.data()), sizeof(uint64_t) * header.size());
+		for (size_t i = 0; i < net.size(); i++) {
+			out.seekp(header[1 + 2 * i]);
+			out.write(reinterpret_cast<const char*>(net[i].data()), sizeof(type) * net[i].size());
+		}
+		out.close();
+		return out && std::rename(temp.c_str(), path.c_str()) == 0;
+	}
+
+	/**
+	 * load the tables, either by mapping a file of the mappable format (zero-copy),
+	 * or by reading a file of the legacy format (or of the mappable format if the tables need a specific placement)
+	 * the properties of the file, if any, are stored to info
+	 * return false if the file cannot be loaded, or if its tables do not match the checksum
+	 */
+	static bool load(const std::string& path, std::vector<basic_weight>& net, properties* info = nullptr) {
+		std::ifstream in(path, std::ios::in | std::ios::binary);
+		if (!in.is_open()) return false;
+		char head[8] = {};
+		in.read(head, 8);
+		if (std::memcmp(head, magic(), 6) == 0 && (head[6] == 1 || head[6] == 2)) {
+			properties prop;
+			std::vector<uint64_t> layout;
+			if (!read_header(in, head[6], prop, layout)) return false;
+			if (!(placement::standard() ? map(path, layout, net) : read(in, layout, net))) return false;
+			if (prop.count("crc32c") && prop["crc32c"] != checksum(net)) return false;
+			if (info) *info = prop;
+			return true;
+		}
+		in.seekg(0);
+		uint32_t size;
+		in.read(reinterpret_cast<char*>(&size), sizeof(size));
+		net.resize(size);
+		for (basic_weight& w : net) in >> w;
+		return bool(in);
+	}
+
+	/**
+	 * the CRC-32C of all tables, as 8 hexadecimal digits
+	 */
+	static std::string checksum(const std::vector<basic_weight>& net) {
+		uint32_t crc = ~0u;
+		for (const basic_weight& w : net) crc = crc32c::update(crc, w.data(), sizeof(type) * w.size());
+		std::stringstream ss;
+		ss << std::hex << std::setw(8) << std::setfill('0') << ~crc;
+		return ss.str();
+	}
+
+	/**
+	 * convert the first count tables of another storage type, where each entry is multiplied by scale,
+	 * e.g., basic_weight<int16_t>::convert(net, net.size(), 64) for fixed-point numbers with 6 fraction bits
+	 */
+	template<typename from>
+	static std::vector<basic_weight> convert(const std::vector<basic_weight<from>>& src, size_t count, float scale = 1) {
+		std::vector<basic_weight> dst;
+		for (size_t i = 0; i < count; i++) {
+			basic_weight w(src[i].size());
+			for (size_t k = 0; k < w.size(); k++) narrow(float(src[i][k]) * scale, w[k]);
+			dst.push_back(std::move(w));
+		}
+		return dst;
+	}
+
 protected:
-	std::vector<type> value;
+	static std::shared_ptr<type> allocate(size_t len) {
+		if (placement::standard()) return std::shared_ptr<type>(new type[len](), std::default_delete<type[]>());
+		std::shared_ptr<char> mem = placement::allocate(sizeof(type) * len);
+		return std::shared_ptr<type>(mem, reinterpret_cast<type*>(mem.get()));
+	}
+
+	/**
+	 * read the header following the magic, i.e., the properties (since version 2) and the (offset, size) of the tables
+	 */
+	static bool read_header(std::istream& in, int version, properties& info, std::vector<uint64_t>& layout) {
+		if (version >= 2) {
+			uint64_t length = 0;
+			in.read(reinterpret_cast<char*>(&length), sizeof(length));
+			if (!in || length % 8 || length > (1 << 20)) return false;
+			std::string text(length, '\0');
+			in.read(&text[0], length);
+			std::stringstream ss(text);
+			for (std::string line; std::getline(ss, line); ) {
+				size_t eq = line.find('=');
+				if (eq != std::string::npos) info[line.substr(0, eq)] = line.substr(eq + 1);
+			}
+		}
+		uint64_t num = 0;
+		in.read(reinterpret_cast<char*>(&num), sizeof(num));
+		if (!in || num > (1 << 20)) return false;
+		layout.resize(2 * num);
+		in.read(reinterpret_cast<char*>(layout.data()), sizeof(uint64_t) * layout.size());
+		return bool(in);
+	}
+
+	/**
+	 * read the tables of the mappable format into allocated tables
+	 */
+	static bool read(std::istream& in, const std::vector<uint64_t>& layout, std::vector<basic_weight>& net) {
+		net.clear();
+		for (size_t i = 0; in && i < layout.size() / 2; i++) {
+			basic_weight w(layout[2 * i + 1]);
+			in.seekg(layout[2 * i]);
+			in.read(reinterpret_cast<char*>(w.data()), sizeof(type) * w.size());
+			net.push_back(std::move(w));
+		}
+		return bool(in);
+	}
+
+	/**
+	 * map the file privately, so that tables are shared with the page cache
+	 * until they are modified (e.g., by training), in which case the touched pages are copied
+	 */
+	static bool map(const std::string& path, const std::vector<uint64_t>& layout, std::vector<basic_weight>& net) {
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd == -1) return false;
+		struct stat st;
+		void* addr = MAP_FAILED;
+		if (::fstat(fd, &st) == 0 && st.st_size > 0)
+			addr = ::mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (addr == MAP_FAILED) return false;
+		size_t len = st.st_size;
+		::madvise(addr, len, MADV_WILLNEED);
+		std::shared_ptr<char> file(static_cast<char*>(addr), [len](char* p) { ::munmap(p, len); });
+
+		net.clear();
+		for (size_t i = 0; i < layout.size() / 2; i++) {
+			uint64_t offset = layout[2 * i], size = layout[2 * i + 1];
+			if (offset % alignment() || offset + sizeof(type) * size > len) return false;
+			basic_weight w;
+			w.value = std::shared_ptr<type>(file, reinterpret_cast<type*>(file.get() + offset));
+			w.table = w.value.get();
+			w.length = size;
+			net.push_back(std::move(w));
+		}
+		return true;
+	}
+
+	static void narrow(float v, float& w) { w = v; }
+	static void narrow(float v, half& w) { w = half(v); }
+	static void narrow(float v, int16_t& w) { w = int16_t(std::max(-32767.0f, std::min(32767.0f, std::round(v)))); }
+
+protected:
+	std::shared_ptr<type> value;
+	type* table;
+	size_t length;
 };
+
+typedef basic_weight<float> weight;
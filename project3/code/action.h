@@ -24,7 +24,8 @@ public:
 	class white; // create a placing action of white with position
 
 public:
-	virtual board::reward apply(board& b) const {
+	virtual board::reward apply(board& b) const; // see below, dispatched by type without lookup
+	board::reward apply_prototype(board& b) const {
 		auto proto = entries().find(type());
 		if (proto != entries().end()) return proto->second->reinterpret(this).apply(b);
 		return -1;
@@ -118,3 +119,16 @@ protected:
 	action& reinterpret(const action* a) const { return *new (const_cast<action*>(a)) white(*a); }
 	static __attribute__((constructor)) void init() { entries()[type_flag('W')] = new white; }
 };
+
+/**
+ * apply the action by a switch on its type, so that the built-in actions cost no more than board::place
+ * (i.e., without the prototype lookup and the reinterpretation), and other registered actions fall back to the prototypes
+ */
+inline board::reward action::apply(board& b) const {
+	switch (type()) {
+	case action::place::type:
+	case action::black::type:
+	case action::white::type: return action::place(*this).action::place::apply(b);
+	default: return apply_prototype(b);
+	}
+}
@@ -20,6 +20,7 @@
 #include <cassert>
 #include "board.h"
 #include "action.h"
+#include "rng.h"
 
 class agent {
 public:
@@ -56,17 +57,37 @@ protected:
 
 /**
  * base agent for agents with randomness
+ * the generator is selected by rng= (see rng.h), and is reseeded by (seed, stream, episode) on each episode,
+ * so that episode i of a seed is the same no matter how many episodes have been played before
+ *
+ * arguments: seed=S, stream=N (an independent stream), episode=I (the index of the first episode, 0 by default)
  */
 class random_agent : public agent {
 public:
-	random_agent(const std::string& args = "") : agent(args) {
+	random_agent(const std::string& args = "") : agent(args),
+		engine(meta.find("rng") != meta.end() ? std::string(meta["rng"]) : "xoshiro"), seed(0), stream(0), episode(0) {
 		if (meta.find("seed") != meta.end())
-			engine.seed(int(meta["seed"]));
+			seed = uint64_t(meta["seed"]);
+		if (meta.find("stream") != meta.end())
+			stream = uint64_t(meta["stream"]);
+		if (meta.find("episode") != meta.end())
+			engine.seed({ seed, stream, episode = uint64_t(meta["episode"]) });
+		else if (meta.find("stream") != meta.end())
+			engine.seed({ seed, stream });
+		else if (meta.find("seed") != meta.end())
+			engine.seed({ seed });
 	}
 	virtual ~random_agent() {}
 
+	virtual void open_episode(const std::string& flag = "") {
+		uint64_t index = episode++;
+		if (engine.generator() != rng::legacy) // rng=std keeps a single sequence as before
+			engine.seed({ seed, stream, index });
+	}
+
 protected:
-	std::default_random_engine engine;
+	rng engine;
+	uint64_t seed, stream, episode;
 };
 
 /**
@@ -88,7 +109,7 @@ public:
 	}
 
 	virtual action take_action(const board& state) {
-		std::shuffle(space.begin(), space.end(), engine);
+		engine.shuffle(space.begin(), space.end());
 		for (const action::place& move : space) {
 			board after = state;
 			if (move.apply(after) == board::legal)
@@ -154,6 +175,22 @@ public:
 		for(int i=0;i<parallel;i++){
 			roots.push_back(new mctsNode(board(), (who == board::black ? board::white : board::black)));
 		}
+		fork_engines();
+	}
+
+	virtual void open_episode(const std::string& flag = "") {
+		random_agent::open_episode(flag);
+		fork_engines();
+	}
+
+	/**
+	 * give each search thread its own stream of the current episode, instead of sharing a single generator
+	 */
+	void fork_engines() {
+		engines.assign(parallel, engine);
+		for(int i=0;i<parallel;i++){
+			engines[i].seed({ seed, stream, episode, uint64_t(i) + 1 });
+		}
 	}
 
 	~mctsPlayer() {
@@ -178,7 +215,7 @@ public:
 		}
 
 		std::vector<std::pair<action::place, int>> action_visit_vec(action_visit.begin(), action_visit.end());
-		std::shuffle(action_visit_vec.begin(), action_visit_vec.end(), engine);
+		engine.shuffle(action_visit_vec.begin(), action_visit_vec.end());
 		int max_visit = 0;
 		for(auto const& i: action_visit_vec){
 			if(i.second > max_visit){
@@ -223,7 +260,7 @@ public:
 			if(node->end_state == false && (int)node->children.size() == 0){
 				bool no_legal_move = true;
 				auto tmp(node->player == board::black ? white_space : black_space);
-				std::shuffle(tmp.begin(), tmp.end(), engine);
+				engines[thread_idx].shuffle(tmp.begin(), tmp.end());
 				if(node->player == board::black){
 					// std::shuffle(white_space.begin(), white_space.end(), engine);
 					for (const action::place& move : tmp) {
@@ -254,37 +291,7 @@ public:
 				int idx = node->expand_idx;
 				node->expand_idx++;
 				node = node->children[idx];
-				board::piece_type player = node->player;
-				board cur_state = node->state;
-				while(true){
-					bool no_legal_move = true;
-					auto tmp(player == board::black ? white_space : black_space);
-					std::shuffle(tmp.begin(), tmp.end(), engine);
-					if(player == board::black){
-						for (const action::place& move : tmp) {
-							board after = cur_state;
-							if (move.apply(after) == board::legal){
-								cur_state = after;
-								no_legal_move = false;
-								break;
-							}
-						}
-					} else {
-						for (const action::place& move : tmp) {
-							board after = cur_state;
-							if (move.apply(after) == board::legal){
-								cur_state = after;
-								no_legal_move = false;
-								break;
-							}
-						}
-					}
-					if(no_legal_move){
-						winner = player;
-						break;
-					}
-					player = (player == board::black ? board::white : board::black);
-				}
+				winner = playout(node->state, node->player, engines[thread_idx]);
 			} else {
 				winner = node->player;
 			}
@@ -299,11 +306,36 @@ public:
 		std::cout << cnt << std::endl;
 	}
 
+	/**
+	 * random playout from a state where player has just moved, until the side to move has no legal move
+	 * return the winner, i.e., the player who made the last move
+	 */
+	board::piece_type playout(board state, board::piece_type player, rng& engine) const {
+		while(true){
+			bool no_legal_move = true;
+			auto tmp(player == board::black ? white_space : black_space);
+			engine.shuffle(tmp.begin(), tmp.end());
+			for (const action::place& move : tmp) {
+				board after = state;
+				if (move.apply(after) == board::legal){
+					state = after;
+					no_legal_move = false;
+					break;
+				}
+			}
+			if(no_legal_move){
+				return player;
+			}
+			player = (player == board::black ? board::white : board::black);
+		}
+	}
+
 	int T = 100;
 	int parallel = 1;
 	std::vector<action::place> black_space;
 	std::vector<action::place> white_space;
 	std::vector<mctsNode*> roots;
+	std::vector<rng> engines;
 	board::piece_type who;
 	std::string white_args;
 };
\ No newline at end of file
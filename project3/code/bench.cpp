@@ -0,0 +1,182 @@
+/**
+ * Framework for NoGo and similar games (C++ 11)
+ * bench.cpp: Micro-benchmarks of the board and player hot paths
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include "board.h"
+#include "action.h"
+#include "agent.h"
+
+/**
+ * run each benchmark on a fixed set of positions, and report the median ns/op over the repetitions
+ * a benchmark is first warmed up for at least 20 ms with doubling iterations, then each repetition
+ * runs as many iterations as take about 10 ms at the fastest warm-up speed
+ */
+class benchmark {
+public:
+	benchmark(size_t reps, const std::string& filter) : reps(reps), filter(filter), sink(0) {}
+
+	template<typename body>
+	void run(const std::string& name, size_t ops, body f) {
+		if (name.find(filter) == std::string::npos) return;
+		typedef std::chrono::steady_clock clock;
+		size_t iters = 1;
+		double fastest = 0; // ns per iteration
+		for (double warmup = 0; warmup < 2e7; iters *= 2) {
+			auto start = clock::now();
+			for (size_t i = 0; i < iters; i++) sink += f();
+			double elapsed = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+			fastest = (warmup == 0) ? elapsed / iters : std::min(fastest, elapsed / iters);
+			warmup += elapsed;
+		}
+		iters = std::max(size_t(1e7 / fastest), size_t(1));
+		std::vector<double> times;
+		for (size_t r = 0; r < reps; r++) {
+			auto start = clock::now();
+			for (size_t i = 0; i < iters; i++) sink += f();
+			times.push_back(std::chrono::duration<double, std::nano>(clock::now() - start).count() / (iters * ops));
+		}
+		std::sort(times.begin(), times.end());
+		results.push_back({ name, times[times.size() / 2], times.front(), iters * ops, reps });
+	}
+
+	void report(std::ostream& out, const std::string& format) const {
+		out << std::fixed << std::setprecision(2);
+		if (format == "json") {
+			out << "[" << std::endl;
+			for (size_t i = 0; i < results.size(); i++) {
+				const result& r = results[i];
+				out << "  { \"benchmark\": \"" << r.name << "\", \"ns_per_op\": " << r.median << ", \"min_ns_per_op\": " << r.min
+					<< ", \"ops\": " << r.ops << ", \"reps\": " << r.reps << " }" << (i + 1 < results.size() ? "," : "") << std::endl;
+			}
+			out << "]" << std::endl;
+		} else {
+			out << "benchmark,ns_per_op,min_ns_per_op,ops,reps" << std::endl;
+			for (const result& r : results)
+				out << r.name << "," << r.median << "," << r.min << "," << r.ops << "," << r.reps << std::endl;
+		}
+	}
+
+private:
+	struct result {
+		std::string name;
+		double median, min;
+		size_t ops, reps;
+	};
+	size_t reps;
+	std::string filter;
+	std::vector<result> results;
+
+public:
+	volatile double sink; // keeps the results alive
+};
+
+int main(int argc, const char* argv[]) {
+	size_t reps = 5, positions = 1024;
+	std::string format = "csv", filter;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		auto match_arg = [&](std::string flag) -> bool {
+			auto it = arg.find_first_not_of('-');
+			return arg.find(flag, it) == it;
+		};
+		auto next_opt = [&]() -> std::string {
+			auto it = arg.find('=') + 1;
+			return it ? arg.substr(it) : argv[++i];
+		};
+		if (match_arg("reps")) {
+			reps = std::stoull(next_opt());
+		} else if (match_arg("positions")) {
+			positions = std::stoull(next_opt());
+		} else if (match_arg("format")) {
+			format = next_opt();
+		} else if (match_arg("filter")) {
+			filter = next_opt();
+		}
+	}
+
+	// canned positions, collected from games of seeded random players
+	std::vector<board> befores, afters;
+	std::vector<action> moves; // stored as actions, so that action::apply is dispatched by type
+	player black("role=black seed=1"), white("role=white seed=2");
+	board b;
+	for (size_t step = 0; befores.size() < positions; step++) {
+		player& who = (step % 2) ? white : black;
+		action::place move = who.take_action(b);
+		board after = b;
+		if (move.apply(after) != board::legal) { // the game is over
+			b = board();
+			step = -1;
+			continue;
+		}
+		befores.push_back(b);
+		afters.push_back(after);
+		moves.push_back(move);
+		b = after;
+	}
+
+	benchmark bench(reps, filter);
+
+	bench.run("board::place", positions, [&]() {
+		board::reward total = 0;
+		for (size_t i = 0; i < positions; i++) {
+			action::place move(moves[i]);
+			board b(befores[i]);
+			total += b.place(move.position(), move.color());
+		}
+		return total;
+	});
+	bench.run("board::check_liberty", positions, [&]() {
+		int total = 0;
+		for (size_t i = 0; i < positions; i++) {
+			action::place move(moves[i]);
+			board::point p = move.position();
+			total += afters[i].check_liberty(p.x, p.y, move.color());
+		}
+		return total;
+	});
+	bench.run("action::apply", positions, [&]() {
+		board::reward total = 0;
+		for (size_t i = 0; i < positions; i++) {
+			board b(befores[i]);
+			total += moves[i].apply(b);
+		}
+		return total;
+	});
+	bench.run("player::take_action", positions, [&]() {
+		unsigned total = 0;
+		black.open_episode();
+		white.open_episode();
+		for (size_t i = 0; i < positions; i++) total += (i % 2 ? white : black).take_action(befores[i]);
+		return total;
+	});
+	bench.run("rng::shuffle(81)", positions, [&]() {
+		action::place space[board::size_x * board::size_y];
+		rng engine;
+		engine.seed({ 3 });
+		for (size_t i = 0; i < positions; i++) engine.shuffle(space, space + board::size_x * board::size_y);
+		return unsigned(space[0]);
+	});
+
+	mctsPlayer mcts("role=black");
+	bench.run("mctsPlayer::playout", positions, [&]() {
+		unsigned total = 0;
+		rng engine;
+		engine.seed({ 4 });
+		for (size_t i = 0; i < positions; i++) total += mcts.playout(afters[i], action::place(moves[i]).color(), engine);
+		return total;
+	});
+
+	bench.report(std::cout, format);
+	return 0;
+}